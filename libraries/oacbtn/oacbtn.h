@@ -11,17 +11,136 @@
 #define OACBTN_H
 
 #include <Arduino.h>
+#include <oacio.h>
+#include <oacring.h>
 
 #define ON 1
 #define OFF 0
 #define DEFAULT_ON_STATE HIGH
 #define DEFAULT_DEBOUNCE 200
+#define DEFAULT_DEBOUNCE_SAMPLES 4
 
 namespace OAC {
 
 typedef void (*NullaryCallback)();
 typedef void (*UnaryCallback)(int state);
 
+/** A change in the level of a digital pin. */
+struct PinEvent {
+  byte pin;
+  byte level;
+  unsigned long time; // in microseconds, as given by micros()
+};
+
+#if defined(__AVR__)
+
+#define PIN_CHANGE_GROUPS 3
+#define PIN_CHANGE_QUEUE_SIZE 16 // must be a power of 2
+
+/**
+ * Capture of pin changes from the pin change interrupts. 
+ * 
+ * Each change in an attached pin is recorded as a `PinEvent` in a queue
+ * by the interrupt handler, and retrieved from `loop()` with `poll()`. 
+ * That way short pulses are captured even if `loop()` is slow. The 
+ * queue has a single producer (the ISR) and a single consumer (the loop),
+ * so no interrupts are disabled to access it. 
+ * 
+ * A pin may be attached with a hook instead. Its changes are not queued
+ * but the hook is invoked from the interrupt handler, which suits decoders
+ * that must see every change, as rotary encoders. 
+ * 
+ * The global `OACPCI` object and the interrupt handlers are defined when
+ * OAC_PIN_CHANGE_CAPTURE is defined before including this library. 
+ */
+class PinChangeCapture {
+public:
+
+  PinChangeCapture() : _overflows(0) {
+    for (byte g = 0; g < PIN_CHANGE_GROUPS; g++) {
+      _groups[g].enabled = 0;
+    }
+  }
+
+  /** 
+   * Start capturing the changes of the given pin. If a hook is given, it 
+   * is invoked from the interrupt handler on each change instead of
+   * queuing an event. Keep it short. Return false if the pin has no pin
+   * change interrupt. 
+   */
+  bool attach(byte pin, NullaryCallback hook = 0) {
+    volatile byte* pcicr = digitalPinToPCICR(pin);
+    if (!pcicr) {
+      return false;
+    }
+    byte group = digitalPinToPCICRbit(pin);
+    byte bit = digitalPinToPCMSKbit(pin);
+    if (group >= PIN_CHANGE_GROUPS) {
+      return false;
+    }
+    Group& g = _groups[group];
+    noInterrupts();
+    g.pins[bit] = pin;
+    g.hooks[bit] = hook;
+    g.masks[bit] = digitalPinToBitMask(pin);
+    g.ports[bit] = portInputRegister(digitalPinToPort(pin));
+    if (*g.ports[bit] & g.masks[bit]) { bitSet(g.levels, bit); }
+    else { bitClear(g.levels, bit); }
+    bitSet(g.enabled, bit);
+    *digitalPinToPCMSK(pin) |= _BV(bit);
+    *pcicr |= _BV(group);
+    interrupts();
+    return true;
+  }
+
+  /** Retrieve the next captured event. Return false if there is none. */
+  bool poll(PinEvent& event) { return _queue.pop(event); }
+
+  /** The number of events discarded because the queue was full. */
+  byte overflows() const { return _overflows; }
+
+  /** Record the changes of a group. To be invoked from its interrupt. */
+  void handle(byte group) {
+    unsigned long now = micros();
+    Group& g = _groups[group];
+    for (byte bit = 0; bit < 8; bit++) {
+      if (!bitRead(g.enabled, bit)) {
+        continue;
+      }
+      byte level = (*g.ports[bit] & g.masks[bit]) ? HIGH : LOW;
+      if (level != bitRead(g.levels, bit)) {
+        g.levels ^= _BV(bit);
+        if (g.hooks[bit]) { g.hooks[bit](); }
+        else { push(g.pins[bit], level, now); }
+      }
+    }
+  }
+
+private:
+
+  struct Group {
+    byte enabled;
+    byte levels;
+    byte pins[8];
+    NullaryCallback hooks[8];
+    byte masks[8];
+    volatile byte* ports[8];
+  };
+
+  Group _groups[PIN_CHANGE_GROUPS];
+  RingBuffer<PinEvent, PIN_CHANGE_QUEUE_SIZE> _queue;
+  volatile byte _overflows;
+
+  void push(byte pin, byte level, unsigned long time) {
+    PinEvent event = { pin, level, time };
+    if (!_queue.push(event)) {
+      _overflows++;
+    }
+  }
+};
+
+#endif
+
 template <int OnState = DEFAULT_ON_STATE,
           long Debounce = DEFAULT_DEBOUNCE>
 class Button {
@@ -31,6 +150,8 @@ public:
       _pin(pin),
       _state(-1),
       _timeMark(0),
+      _eventMark(0),
+      _eventSeen(false),
       _onPressed(0),
       _onReleased(0),
       _onToggled(0) {
@@ -56,14 +177,25 @@ public:
     int prevState = _state;
     int newState = digitalRead(_pin);
     if ((newState != prevState) && (millis() - _timeMark > Debounce)) {
-      _state = newState;
-      if (_onPressed && (_state == OnState))
-        _onPressed();
-      else if (_onReleased && (_state != OnState))
-        _onReleased();
-      if (_onToggled)
-        _onToggled(_state == OnState);
-      _timeMark = millis();
+      setState(newState);
+    }
+    return _state;
+  }
+
+  /**
+   * Check a captured pin event. Events of other pins are ignored. The 
+   * debounce time is measured between event timestamps, so changes are
+   * detected regardless of the time spent by the loop. A change ignored 
+   * while debouncing is detected by the next `check()` after the debounce
+   * time. The first event is accepted at once, since there is no previous
+   * one to measure the debounce time from.
+   */
+  int check(const PinEvent& event) {
+    if (event.pin == _pin && event.level != _state && 
+        (!_eventSeen || event.time - _eventMark > Debounce * 1000UL)) {
+      _eventMark = event.time;
+      _eventSeen = true;
+      setState(event.level);
     }
     return _state;
   }
@@ -73,11 +205,195 @@ private:
   int _pin;
   int _state;
   long _timeMark;
+  unsigned long _eventMark;
+  bool _eventSeen;
+
+  void setState(int newState) {
+    _state = newState;
+    if (_onPressed && (_state == OnState))
+      _onPressed();
+    else if (_onReleased && (_state != OnState))
+      _onReleased();
+    if (_onToggled)
+      _onToggled(_state == OnState);
+    _timeMark = millis();
+  }
   NullaryCallback _onPressed;
   NullaryCallback _onReleased;
   UnaryCallback _onToggled;
 };
 
+/**
+ * A debouncer for a set of digital inputs packed in the bits of `Bits`. 
+ * 
+ * An input changes its debounced state only after `Samples` consecutive 
+ * samples (from 1 to 15) with the new level. Each input has its own 
+ * sample counter, whose bits are stored vertically: bit N of `_count[P]` 
+ * is the bit P of the counter of input N. That way all inputs are
+ * processed at once with a handful of bitwise operations per sample. 
+ */
+template <typename Bits, byte Samples = DEFAULT_DEBOUNCE_SAMPLES>
+class VerticalDebouncer {
+public:
+
+  enum { PLANES = Samples < 2 ? 1 : Samples < 4 ? 2 : Samples < 8 ? 3 : 4 };
+
+  VerticalDebouncer(Bits state = 0) { reset(state); }
+
+  /** Reset the debounced state and the sample counters. */
+  void reset(Bits state) {
+    _state = state;
+    _changed = 0;
+    for (int p = 0; p < PLANES; p++) {
+      _count[p] = 0;
+    }
+  }
+
+  /** Process a new sample of the inputs and return the debounced state. */
+  Bits update(Bits sample) {
+    Bits delta = sample ^ _state;
+
+    // Increment the counters of inputs that differ from the state, and
+    // clear the counters of the inputs that don't
+    Bits carry = delta;
+    for (int p = 0; p < PLANES; p++) {
+      Bits next = _count[p] & carry;
+      _count[p] = (_count[p] ^ carry) & delta;
+      carry = next;
+    }
+
+    // Toggle the inputs whose counter reached the number of samples
+    Bits reached = delta;
+    for (int p = 0; p < PLANES; p++) {
+      reached &= ((Samples >> p) & 1) ? _count[p] : Bits(~_count[p]);
+    }
+    for (int p = 0; p < PLANES; p++) {
+      _count[p] &= ~reached;
+    }
+    _state ^= reached;
+    _changed = reached;
+    return _state;
+  }
+
+  /** The debounced state of the inputs. */
+  Bits state() const { return _state; }
+
+  /** The inputs whose debounced state changed in the last sample. */
+  Bits changed() const { return _changed; }
+
+  /** The inputs that changed to HIGH in the last sample. */
+  Bits rising() const { return _changed & _state; }
+
+  /** The inputs that changed to LOW in the last sample. */
+  Bits falling() const { return _changed & ~_state; }
+
+private:
+
+  // Fails to compile if Samples is not between 1 and 15
+  typedef char SamplesCheck[(Samples >= 1 && Samples <= 15) ? 1 : -1];
+
+  Bits _state;
+  Bits _changed;
+  Bits _count[PLANES];
+};
+
+/**
+ * A bank of up to 32 buttons sampled at once.
+ * 
+ * On each scan, every port holding any of the buttons is read once, and
+ * all buttons are debounced in parallel by a `VerticalDebouncer`. A button
+ * changes its state after `Samples` consecutive samples with the new 
+ * state. Buttons are identified by their index in the bank, which is 
+ * also their bit in the masks returned by `state()`, `pressed()`, 
+ * `released()` and `toggled()`.
+ */
+template <int NPINS,
+          int OnState = DEFAULT_ON_STATE,
+          byte Samples = DEFAULT_DEBOUNCE_SAMPLES>
+class ButtonBank {
+public:
+
+  ButtonBank() : _samplePeriod(0), _timeMark(0), _toggled(0) {}
+
+  /** Add a button to the bank. Return its index, or -1 if full. */
+  int addPin(int pin) {
+    pinMode(pin, INPUT);
+    return _pins.addPin(pin);
+  }
+
+  /** 
+   * Set the minimum time in milliseconds between samples. By default, a
+   * new sample is taken on each scan. 
+   */
+  void setSamplePeriod(unsigned long period) { _samplePeriod = period; }
+
+  /** 
+   * Sample the buttons if the sample period is elapsed. Return true if 
+   * any button changed its state. 
+   */
+  bool scan() {
+    _toggled = 0;
+    if (_pins.size() == 0) {
+      return false;
+    }
+    if (_samplePeriod) {
+      unsigned long now = millis();
+      if (now - _timeMark < _samplePeriod) {
+        return false;
+      }
+      _timeMark = now;
+    }
+    unsigned long sample = _pins.read();
+    if (OnState == LOW) {
+      sample = ~sample & (0xffffffffUL >> (32 - _pins.size()));
+    }
+    _debouncer.update(sample);
+    _toggled = _debouncer.changed();
+    return _toggled != 0;
+  }
+
+  /** 
+   * Set the state of the buttons, e.g. from captured pin events. It is 
+   * kept until changed by the given number of samples. 
+   */
+  void setState(unsigned long state) { _debouncer.reset(state); }
+
+  /** The buttons that are pressed. */
+  unsigned long state() const { return _debouncer.state(); }
+
+  /** The buttons that were pressed in the last scan. */
+  unsigned long pressed() const { return _toggled & _debouncer.state(); }
+
+  /** The buttons that were released in the last scan. */
+  unsigned long released() const { return _toggled & ~_debouncer.state(); }
+
+  /** The buttons that were pressed or released in the last scan. */
+  unsigned long toggled() const { return _toggled; }
+
+private:
+
+  PinGroup<NPINS> _pins;
+  VerticalDebouncer<unsigned long, Samples> _debouncer;
+  unsigned long _samplePeriod;
+  unsigned long _timeMark;
+  unsigned long _toggled;
+};
+
+/**
+ * A rotary switch with NumPos positions connected to consecutive pins. 
+ * 
+ * The positions are sampled as a `ButtonBank`, taking DEFAULT_DEBOUNCE_SAMPLES
+ * samples along the Debounce time. The selected position is the highest
+ * active one, or -1 if none is active.
+ *
+ * A new position is reported by `check()` once it has been stable for all
+ * the samples. The first sample with the new position is taken within
+ * Debounce / 4 after the switch is turned and 3 more follow, so it is 
+ * reported between 0.75 * Debounce and Debounce milliseconds later. Older
+ * versions reported it at once and then ignored the pins for the Debounce
+ * time. Checking captured pin events instead (see `check(const PinEvent&)`)
+ * still selects a position at once. 
+ */
 template <int NumPos,
           int OnState = DEFAULT_ON_STATE,
           long Debounce = DEFAULT_DEBOUNCE>
@@ -85,46 +401,70 @@ class RotarySwitch
 {
 public:
 
-  typedef RotarySwitch<NumPos - 1, OnState, Debounce> ParentClass;
-
-  RotarySwitch(int fromPin) :
-      _parent(fromPin),
-      _pos(-1),
-      _btn(fromPin + NumPos - 1) {
+  RotarySwitch(int fromPin) : _fromPin(fromPin), _pos(-1), _onSelect(0) {
+    for (int i = 0; i < NumPos; i++) {
+      _bank.addPin(fromPin + i);
+    }
+    _bank.setSamplePeriod(Debounce / DEFAULT_DEBOUNCE_SAMPLES);
   }
 
   void setOnSelect(UnaryCallback onSelect) { _onSelect = onSelect; }
 
   int check() {
     int prevPos = _pos;
-    int state = _btn.check();
-    _pos = (state == OnState) ? (NumPos - 1) : _parent.check();
+    _bank.scan();
+    unsigned long active = _bank.state();
+    _pos = active ? highestBit(active) : -1;
     if (_pos != -1 && _pos != prevPos && _onSelect) {
       _onSelect(_pos);
     }
     return _pos;
   }
 
+  /**
+   * Check a captured pin event. A position is selected as soon as its
+   * pin changes to the active state. Events of other pins are ignored.
+   */
+  int check(const PinEvent& event) {
+    int pos = event.pin - _fromPin;
+    if (pos >= 0 && pos < NumPos && event.level == OnState && pos != _pos) {
+      _bank.setState(1UL << pos);
+      _pos = pos;
+      if (_onSelect) {
+        _onSelect(_pos);
+      }
+    }
+    return _pos;
+  }
+
 private:
 
-  ParentClass _parent;
+  ButtonBank<NumPos, OnState> _bank;
+  int _fromPin;
   int _pos;
-  Button<OnState, Debounce> _btn;
   UnaryCallback _onSelect;
+
+  static int highestBit(unsigned long bits) {
+    return int(sizeof(bits) * 8) - 1 - __builtin_clzl(bits);
+  }
 };
 
-template <int OnState,
-          long Debounce>
-class RotarySwitch<0, OnState, Debounce> {
-public:
+} // namespace OAC
 
-  RotarySwitch(int fromPin) {}
+#if defined(__AVR__) && defined(OAC_PIN_CHANGE_CAPTURE)
 
-  void setOnSelect(UnaryCallback onSelect) {}
+OAC::PinChangeCapture OACPCI;
 
-  int check() { return -1; }
-};
+#if defined(PCINT0_vect)
+ISR(PCINT0_vect) { OACPCI.handle(0); }
+#endif
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect) { OACPCI.handle(1); }
+#endif
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect) { OACPCI.handle(2); }
+#endif
 
-} // namespace OAC
+#endif
 
 #endif
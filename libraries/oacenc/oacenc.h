@@ -12,6 +12,9 @@
 
 #include <arduino.h>
 #include <limits.h>
+#include <oacio.h>
+
+#define ROTARY_ENCODER_STEPS_PER_DETENT 4
 
 namespace OAC {
 
@@ -80,35 +83,103 @@ private:
 };
 
 /**
- * A rotary encoder. 
+ * An acceleration profile for a rotary encoder. The multiplier applied to
+ * each detent grows linearly from 1, when the time since the previous 
+ * detent is `slowInterval` or longer, up to `maxMultiplier`, when it is
+ * `fastInterval` or shorter. Times are in milliseconds. 
+ */
+struct EncoderAcceleration {
+   unsigned int slowInterval;
+   unsigned int fastInterval;
+   byte maxMultiplier;
+
+   /** The multiplier for detents the given milliseconds apart. */
+   byte multiplier(unsigned long interval) const {
+      if (maxMultiplier <= 1 || interval >= slowInterval) { return 1; }
+      if (interval <= fastInterval) { return maxMultiplier; }
+      return 1 + (maxMultiplier - 1) * (slowInterval - interval) / 
+         (slowInterval - fastInterval);
+   }
+};
+
+/**
+ * A quadrature decoder. 
  * 
- * The rotary encoder sends quadratic signals across two digital lines. 
+ * A rotary encoder sends quadrature signals across two digital lines. 
  * The shift between such signals can be used to determine the movement
  * of the rotary encoder.
+ * 
+ * Every change of the lines is decoded with a state table, so the four
+ * transitions of each cycle are counted and the direction is known from
+ * any of them. A transition where both lines change at once is invalid
+ * (a step was missed or it is noise). It is not counted but reported by
+ * `missedSteps()`.
+ * 
+ * The decoder is fed with samples of the lines by `update()`, which may 
+ * be invoked from an interrupt handler. The detents are retrieved with 
+ * `read()`. See `RotaryEncoder` and `ShiftedEncoder` for encoders whose 
+ * lines are connected to digital pins and shift registers respectively. 
  */
-class RotaryEncoder {
+class QuadratureDecoder {
 public:
-  
-   RotaryEncoder() : _lastA(LOW) {}
-  
-   void setPins(byte pinA, byte pinB) {
-      _pinA = pinA;
-      _pinB = pinB;
 
-      pinMode(_pinA, INPUT);
-      pinMode(_pinB, INPUT);
+   QuadratureDecoder() : 
+         _state(0), _count(0), _missed(0), _stepTime(0), _detentTime(0),
+         _stepsPerDetent(ROTARY_ENCODER_STEPS_PER_DETENT) {
+      _accel.slowInterval = 0;
+      _accel.fastInterval = 0;
+      _accel.maxMultiplier = 1;
+   }
+
+   /** 
+    * Set the number of transitions from a detent to the next one. That is
+    * 4 for encoders with a full cycle per detent (the default), 2 for 
+    * half a cycle and 1 for encoders with a detent on every transition.
+    */
+   void setStepsPerDetent(byte steps) { _stepsPerDetent = steps; }
+
+   /** 
+    * Set the acceleration profile applied by `read()`. A single detent
+    * after a pause always counts as 1, so the encoder is still precise
+    * when turned slowly.
+    */
+   void setAcceleration(const EncoderAcceleration& accel) { _accel = accel; }
+
+   /** Set the current level of the lines without counting a transition. */
+   void reset(byte a, byte b) { _state = (a ? 2 : 0) | (b ? 1 : 0); }
+
+   /** 
+    * Decode a sample of the lines and count the transition, if any. It may
+    * be invoked from an interrupt handler.
+    */
+   void update(byte a, byte b) {
+      byte state = (a ? 2 : 0) | (b ? 1 : 0);
+      switch (transition(_state, state)) {
+         case 1: _count++; _stepTime = millis(); break;
+         case -1: _count--; _stepTime = millis(); break;
+         case 2: _missed++; break;
+      }
+      _state = state;
    }
   
-   /** Read the increment of the encoder, or 0 if none. */
+   /** 
+    * Read the increment of the encoder in detents since the last read, 
+    * or 0 if none. If an acceleration profile is set, the increment is
+    * multiplied according to the time between detents. 
+    */
    int read() {
-      byte a = digitalRead(_pinA);
-      byte b = digitalRead(_pinB);
-      int result = 0;
-      if (!a && _lastA) {
-         result = b ? 1 : -1;
+      noInterrupts();
+      int count = _count;
+      int detents = count / _stepsPerDetent;
+      _count = count - detents * _stepsPerDetent;
+      unsigned long stepTime = _stepTime;
+      interrupts();
+      if (detents == 0) {
+         return 0;
       }
-      _lastA = a;
-      return result;
+      unsigned long interval = (stepTime - _detentTime) / abs(detents);
+      _detentTime = stepTime;
+      return detents * _accel.multiplier(interval);
    }
   
    /**
@@ -121,12 +192,141 @@ public:
       long inc = read() * mult;
       return (inc != 0) ? num.inc(inc) : 0;
    }
+
+   /** The number of invalid transitions since the encoder was set up. */
+   unsigned int missedSteps() const {
+      noInterrupts();
+      unsigned int missed = _missed;
+      interrupts();
+      return missed;
+   }
   
 private:
 
-   byte _pinA;
-   byte _pinB;
-   byte _lastA;
+   volatile byte _state;
+   volatile int _count;
+   volatile unsigned int _missed;
+   volatile unsigned long _stepTime;
+   unsigned long _detentTime;
+   byte _stepsPerDetent;
+   EncoderAcceleration _accel;
+
+   /**
+    * The movement from a state of the lines to another, being each state
+    * (A << 1) | B. Clockwise goes 00, 10, 11, 01. Return 2 if the 
+    * transition is invalid. 
+    */
+   static signed char transition(byte from, byte to) {
+      static const signed char table[16] = {
+          0, -1,  1,  2,
+          1,  0,  2, -1,
+         -1,  2,  0,  1,
+          2,  1, -1,  0,
+      };
+      return table[(from << 2) | to];
+   }
+};
+
+/**
+ * A rotary encoder connected to two digital pins. 
+ * 
+ * The lines are sampled by `update()`, which may be invoked from the
+ * interrupts of the encoder pins so no transition is lost if `loop()`
+ * is slow. `read()` also samples the lines, so the encoder still works
+ * if it is only polled. 
+ */
+class RotaryEncoder : public QuadratureDecoder {
+public:
+  
+   void setPins(byte pinA, byte pinB) {
+      pinMode(pinA, INPUT);
+      pinMode(pinB, INPUT);
+
+      _pinA.setPin(pinA);
+      _pinB.setPin(pinB);
+      reset(_pinA.read(), _pinB.read());
+   }
+
+   /** 
+    * Sample the lines and count the transition, if any. It may be invoked
+    * from the interrupt handler of the encoder pins.
+    */
+   void update() { QuadratureDecoder::update(_pinA.read(), _pinB.read()); }
+  
+   /** Sample the lines and read the increment of the encoder. */
+   int read() {
+      noInterrupts();
+      update();
+      interrupts();
+      return QuadratureDecoder::read();
+   }
+  
+   /** Sample the lines and apply the increment to the ranged number. */
+   long read(RangedNumber& num, int mult = 1) {
+      long inc = read() * mult;
+      return (inc != 0) ? num.inc(inc) : 0;
+   }
+  
+private:
+
+   FastPin _pinA;
+   FastPin _pinB;
+};
+
+/**
+ * A rotary encoder connected to two input lines of shift registers, as
+ * the 4021's of a chain of expansion cards.
+ * 
+ * The encoder is updated from a snapshot of the chain after each read,
+ * with `update()` for raw bytes or `updateFrom()` for expansion cards.
+ * A transition is lost if the lines change twice between two reads, so
+ * the chain must be read at least twice per transition at the fastest 
+ * turn expected. Do not debounce the lines: the state table already 
+ * tolerates bounces, but filtered samples arrive too late. The first
+ * update after `setLines()` only takes the level of the lines, so the
+ * position of the encoder at rest is not counted as a transition. 
+ */
+class ShiftedEncoder : public QuadratureDecoder {
+public:
+
+   ShiftedEncoder() : _lineA(0), _lineB(0), _primed(false) {}
+
+   /** Set the input lines, numbered from the first bit of the chain. */
+   void setLines(int lineA, int lineB) {
+      _lineA = lineA;
+      _lineB = lineB;
+      _primed = false;
+   }
+
+   /** 
+    * Update from the bytes read from the chain, e.g. by 
+    * `Shift4021::shiftBytesIn()`. 
+    */
+   void update(const byte* data) {
+      sample(bitRead(data[_lineA / 8], _lineA % 8),
+             bitRead(data[_lineB / 8], _lineB % 8));
+   }
+
+   /** Update from the last read of an `ExpansionCard`. */
+   template <typename Card>
+   void updateFrom(const Card& card) {
+      sample(card.isInputActive(_lineA), card.isInputActive(_lineB));
+   }
+
+private:
+
+   int _lineA;
+   int _lineB;
+   bool _primed;
+
+   void sample(byte a, byte b) {
+      if (!_primed) {
+         reset(a, b);
+         _primed = true;
+         return;
+      }
+      QuadratureDecoder::update(a, b);
+   }
 };
 
 }
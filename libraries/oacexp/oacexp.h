@@ -10,57 +10,237 @@
 #ifndef OACEXP_H
 #define OACEXP_H
 
+#include <oacbtn.h>
 #include <oacshift.h>
 
 namespace OAC {
 
+/**
+ * The debouncers of the input lines of a chain of NBYTES expansion cards.
+ * A line changes its state after `Samples` consecutive reads with the new
+ * level (see `VerticalDebouncer`). 
+ */
+template <int NBYTES, byte Samples>
+class ChainDebouncer {
+public:
+
+   /** Process a new sample of the lines of given card. */
+   byte update(int card, byte sample) {
+      return _cards[card].update(sample);
+   }
+
+private:
+
+   VerticalDebouncer<byte, Samples> _cards[NBYTES];
+};
+
+/**
+ * With a single sample the lines are taken as read, so no counters are
+ * allocated nor updated.
+ */
+template <int NBYTES>
+class ChainDebouncer<NBYTES, 1> {
+public:
+
+   byte update(int, byte sample) { return sample; }
+};
+
+/**
+ * A chain of NBYTES expansion cards.
+ * 
+ * The 4021 of each card is connected to the serial input of the 4021 of
+ * the previous card, and the 595 of each card to the serial output of the
+ * 595 of the previous card. The whole chain is read and written using 
+ * the pins of the first card in a single latch cycle. 
+ * 
+ * Input and output lines are numbered from the first card of the chain:
+ * lines 0 to 7 belong to the first card, 8 to 15 to the second one, etc.
+ * Functions returning or receiving `Bits` pack up to 32 lines in a byte,
+ * word or unsigned long depending on NBYTES. Except for `readInput()`, they
+ * fail to compile in chains of more than 4 cards, whose lines don't fit:
+ * use the functions taking a card, a line or one byte per card instead. 
+ * 
+ * Input lines are debounced when DebounceSamples is greater than 1: a line
+ * changes its state after that number of consecutive reads with the new
+ * level (see `VerticalDebouncer`). The timing of the 4021 signals is given
+ * by InputTiming (see `BasicShift4021`).
+ */
+template <int NBYTES = 1, 
+          typename InputTiming = Shift4021FastTiming,
+          byte DebounceSamples = 1>
 class ExpansionCard {
 
 public:
 
-   ExpansionCard() : prevInput(0), currentInput(0) {}
+   typedef typename ShiftBits<NBYTES>::Type Bits;
 
-   /** Set the pins to be used by this expansion card. */
+   /** The number of cards whose lines fit in `Bits`. */
+   enum { PACKED_BYTES = NBYTES < int(sizeof(Bits)) ? NBYTES : int(sizeof(Bits)) };
+
+   ExpansionCard() {
+      for (int i = 0; i < NBYTES; i++) {
+         prevInput[i] = currentInput[i] = 0;
+      }
+   }
+
+   /** Set the pins to be used by the first expansion card of the chain. */
    void setPins(int i0, int i1, int i2, int o0, int o1, int o2) {
       input.setPins(i0, i1, i2);
       output.setPins(o0, o1, o2);
    }
 
    /** 
-    * Read the input from the shift in register.
+    * Read the input from the shift in registers.
     * 
-    * This reads one byte from the shift-in register, store that byte 
-    * internally and returns it.
+    * This reads one byte from the shift-in register of each card, store 
+    * them internally and returns them. In chains of more than 4 cards, 
+    * only the lines of the first 4 are returned, but all of them are read.
     */
-   byte readInput() {
+   Bits readInput() {
       input.parallelIn();
-      prevInput = currentInput;
-      currentInput = input.shiftByteIn();
-      return currentInput;
+      byte sample[NBYTES];
+      input.shiftBytesIn(sample, NBYTES);
+      for (int i = 0; i < NBYTES; i++) {
+         prevInput[i] = currentInput[i];
+         currentInput[i] = debouncer.update(i, sample[i]);
+      }
+      return pack(currentInput);
+   }
+
+   /** The input lines that were active in last read. */
+   Bits inputState() const {
+      checkPacked();
+      return pack(currentInput);
    }
 
    /** The input lines that have been activated in last read. */
-   byte inputActivated() {
-      return (prevInput ^ currentInput) & currentInput;
+   Bits inputActivated() const {
+      checkPacked();
+      return pack(prevInput, currentInput);
    }
 
    /** The input lines that have been deactivated in last read. */
-   byte inputDeactivated() {
-      return (prevInput ^ currentInput) & prevInput;
+   Bits inputDeactivated() const {
+      checkPacked();
+      return pack(currentInput, prevInput);
    }
 
-   /** Write the given byte to the shift-out register. */
-   void writeOutput(byte out) {
-      output.shiftByteOut(out);
+   /** The input lines of given card that have been activated in last read. */
+   byte inputActivated(byte card) const {
+      return (prevInput[card] ^ currentInput[card]) & currentInput[card];
+   }
+
+   /** The input lines of given card that have been deactivated in last read. */
+   byte inputDeactivated(byte card) const {
+      return (prevInput[card] ^ currentInput[card]) & prevInput[card];
+   }
+
+   /**
+    * The first input line activated in last read from line `from` onwards,
+    * or -1 if there is none. All the activated lines can be visited as in:
+    * 
+    *    for (int line = card.nextInputActivated(); 
+    *         line >= 0; 
+    *         line = card.nextInputActivated(line + 1)) { ... }
+    * 
+    * Cards with no activated lines are skipped with a single comparison,
+    * so the cost depends on the number of changes rather than on the 
+    * number of lines.
+    */
+   int nextInputActivated(int from = 0) const {
+      return nextEdge(prevInput, currentInput, from);
+   }
+
+   /**
+    * The first input line deactivated in last read from line `from` 
+    * onwards, or -1 if there is none. 
+    */
+   int nextInputDeactivated(int from = 0) const {
+      return nextEdge(currentInput, prevInput, from);
+   }
+
+   /** Return true if the given input line was active in last read. */
+   boolean isInputActive(int line) const {
+      return bitRead(currentInput[line >> 3], line & 0x07);
+   }
+
+   /** Write the given lines to the shift-out registers. */
+   void writeOutput(Bits out) {
+      checkPacked();
+      byte data[NBYTES];
+      for (int i = 0; i < NBYTES; i++) {
+         data[i] = (i < PACKED_BYTES) ? byte(out >> (8 * i)) : 0;
+      }
+      writeOutput(data);
+   }
+
+   /** 
+    * Write one byte per card to the shift-out registers. 
+    * 
+    * In chains of up to 4 cards, the write is skipped if the registers
+    * already hold the given bytes (see `Shift595`). Otherwise all the 
+    * cards are latched at once after the last bit is shifted, so no 
+    * intermediate state is shown in the output lines.
+    */
+   void writeOutput(const byte* out) {
+      output.shiftBytesOut(out, NBYTES);
+   }
+
+   /** The number of output writes skipped because nothing changed. */
+   unsigned long skippedWrites() const {
+      return output.skippedWrites();
    }
 
 private:
 
-   Shift4021 input;
+   BasicShift4021<InputTiming> input;
    Shift595 output;
+   ChainDebouncer<NBYTES, DebounceSamples> debouncer;
+
+   byte prevInput[NBYTES];
+   byte currentInput[NBYTES];
+
+   /** 
+    * The first line from `line` onwards that is inactive in `from` and
+    * active in `to`, or -1 if there is none. 
+    */
+   static int nextEdge(const byte* from, const byte* to, int line) {
+      int card = line >> 3;
+      byte mask = byte(0xff << (line & 0x07));
+      for (; card < NBYTES; card++) {
+         byte edges = (from[card] ^ to[card]) & to[card] & mask;
+         if (edges) {
+            return (card << 3) + __builtin_ctz(edges);
+         }
+         mask = 0xff;
+      }
+      return -1;
+   }
+
+   /** Pack the lines that are inactive in `from` and active in `to`. */
+   static Bits pack(const byte* from, const byte* to) {
+      Bits result = 0;
+      for (int i = 0; i < PACKED_BYTES; i++) {
+         byte lines = (from[i] ^ to[i]) & to[i];
+         result |= Bits(lines) << (8 * i);
+      }
+      return result;
+   }
 
-   byte prevInput;
-   byte currentInput;
+   /** Pack the lines that are active in `lines`. */
+   static Bits pack(const byte* lines) {
+      Bits result = 0;
+      for (int i = 0; i < PACKED_BYTES; i++) {
+         result |= Bits(lines[i]) << (8 * i);
+      }
+      return result;
+   }
+
+   /** Fails to compile if the lines of the chain don't fit in `Bits`. */
+   static void checkPacked() {
+      typedef char PackedCheck[NBYTES <= int(sizeof(Bits)) ? 1 : -1];
+      (void) sizeof(PackedCheck);
+   }
 };
 
 } // namespace OAC
@@ -10,19 +10,357 @@
 #ifndef OAC_IO_H
 #define OAC_IO_H
 
+#include <Arduino.h>
+
 namespace OAC {
 
+/**
+ * A digital pin accessed through its port registers. 
+ * 
+ * The port and mask of the pin are resolved once in `setPin()`, so reads
+ * and writes take a few cycles instead of the microseconds required by 
+ * `digitalRead()` and `digitalWrite()`. The pin mode must be configured
+ * separately with `pinMode()`. In boards other than AVR, it falls back to
+ * `digitalRead()` and `digitalWrite()`.
+ */
+class FastPin {
+public:
+
+   FastPin() : _pin(0) {}
+
+   void setPin(byte pin) {
+      _pin = pin;
+#if defined(__AVR__)
+      byte port = digitalPinToPort(pin);
+      _mask = digitalPinToBitMask(pin);
+      _in = portInputRegister(port);
+      _out = portOutputRegister(port);
+#endif
+   }
+
+   byte pin() const { return _pin; }
+
+   byte read() const {
+#if defined(__AVR__)
+      return (*_in & _mask) ? HIGH : LOW;
+#else
+      return digitalRead(_pin);
+#endif
+   }
+
+   /** 
+    * Write the pin. Interrupts are disabled while the port is updated, so
+    * it is safe to use even if an ISR writes other pins of the same port.
+    */
+   void write(byte value) {
+#if defined(__AVR__)
+      byte oldSREG = SREG;
+      cli();
+      writeFromIsr(value);
+      SREG = oldSREG;
+#else
+      digitalWrite(_pin, value);
+#endif
+   }
+
+   /** Write the pin. Interrupts must be disabled, e.g. within an ISR. */
+   void writeFromIsr(byte value) {
+#if defined(__AVR__)
+      if (value) { *_out |= _mask; }
+      else { *_out &= ~_mask; }
+#else
+      digitalWrite(_pin, value);
+#endif
+   }
+
+private:
+
+   byte _pin;
+#if defined(__AVR__)
+   byte _mask;
+   volatile byte* _in;
+   volatile byte* _out;
+#endif
+};
+
+/**
+ * A group of up to 32 digital input pins read at once. 
+ * 
+ * Reading the group returns the level of the pins packed in an unsigned 
+ * long, where bit N is the level of the Nth pin added to the group. Each
+ * port is read only once, no matter how many pins of the group it holds.
+ * When all the pins are consecutive bits of the same port, the result is
+ * obtained from that port with a shift and a mask. In boards other than 
+ * AVR, it falls back to `digitalRead()`.
+ */
+template <int NPINS>
+class PinGroup {
+public:
+
+   PinGroup() : _count(0), _nports(0), _contiguous(false) {}
+
+   /** The number of pins in the group. */
+   byte size() const { return _count; }
+
+   /** The number of port reads needed to read the group. */
+   byte portCount() const {
+#if defined(__AVR__)
+      return _nports;
+#else
+      return _count;
+#endif
+   }
+
+   /** Remove all the pins from the group. */
+   void clear() {
+      _count = 0;
+      _nports = 0;
+      _contiguous = false;
+   }
+
+   /** 
+    * Add a pin to the group. Return its index in the group, or -1 if the 
+    * group is full. The pin mode must be configured separately.
+    */
+   int addPin(byte pin) {
+      if (_count >= NPINS || _count >= 32) {
+         return -1;
+      }
+      byte index = _count++;
+      _pins[index] = pin;
+#if defined(__AVR__)
+      volatile byte* port = portInputRegister(digitalPinToPort(pin));
+      byte p = 0;
+      while (p < _nports && _ports[p] != port) { p++; }
+      if (p == _nports) { _ports[_nports++] = port; }
+      _portIndex[index] = p;
+      _mask[index] = digitalPinToBitMask(pin);
+      _contiguous = (index == 0) || (_contiguous && _nports == 1 && 
+         _mask[index] == byte(_mask[index - 1] << 1));
+      _shift = __builtin_ctz(_mask[0]);
+#endif
+      return index;
+   }
+
+   /** Return true if all the pins are consecutive bits of one port. */
+   boolean isContiguous() const { return _contiguous; }
+
+   /** Read the level of all pins in the group. */
+   unsigned long read() const {
+      unsigned long result = 0;
+      unsigned long bit = 1;
+#if defined(__AVR__)
+      byte snapshot[NPINS];
+      for (byte p = 0; p < _nports; p++) {
+         snapshot[p] = *_ports[p];
+      }
+      if (_contiguous) {
+         return (snapshot[0] >> _shift) & byte((1 << _count) - 1);
+      }
+      for (byte i = 0; i < _count; i++, bit <<= 1) {
+         if (snapshot[_portIndex[i]] & _mask[i]) { result |= bit; }
+      }
+#else
+      for (byte i = 0; i < _count; i++, bit <<= 1) {
+         if (digitalRead(_pins[i])) { result |= bit; }
+      }
+#endif
+      return result;
+   }
+
+private:
+
+   byte _pins[NPINS];
+   byte _count;
+   byte _nports;
+   boolean _contiguous;
+#if defined(__AVR__)
+   byte _shift;
+   byte _portIndex[NPINS];
+   byte _mask[NPINS];
+   volatile byte* _ports[NPINS];
+#endif
+};
+
+#if defined(__AVR__)
+
+/* 
+ * The scanner settings. They may be defined before including the library
+ * to override these defaults. 
+ */
+#ifndef ADC_SCANNER_CHANNELS
+#define ADC_SCANNER_CHANNELS 8
+#endif
+#ifndef ADC_SCANNER_OVERSAMPLING
+#define ADC_SCANNER_OVERSAMPLING 2 // extra bits, from 4^N samples per value
+#endif
+#ifndef ADC_SCANNER_FILTER
+#define ADC_SCANNER_FILTER 2       // low-pass filter weight, as 1/2^N
+#endif
+
+/**
+ * A scanner of analog channels driven by the ADC interrupt. 
+ * 
+ * The registered channels are converted one after the other in the 
+ * background. For each value, 4^ADC_SCANNER_OVERSAMPLING samples are 
+ * summed and decimated, which adds ADC_SCANNER_OVERSAMPLING bits of 
+ * resolution, and then passed through a first order low-pass filter. 
+ * The latest filtered value is read without waiting for any conversion.
+ * 
+ * The ADC runs at 125kHz (prescaler 128 at 16MHz), so each sample takes
+ * 104us. With the default settings a channel gets a new value every
+ * 1.7ms times the number of channels. A channel reads 0 until its first
+ * value is ready (see `isReady()`). 
+ * 
+ * `analogRead()` must not be used while the scanner is running. The global
+ * `OACADC` object and the interrupt handler are defined when 
+ * OAC_ADC_SCANNER is defined before including this library. 
+ */
+class AdcScanner {
+public:
+
+   enum { 
+      BITS = 10 + ADC_SCANNER_OVERSAMPLING,
+      SAMPLES = 1 << (2 * ADC_SCANNER_OVERSAMPLING),
+   };
+
+   AdcScanner() : _count(0), _current(0), _samples(0), _sum(0) {}
+
+   /** 
+    * Add an analog pin to the scan and start scanning if needed. Return
+    * its channel in the scanner, or -1 if there is no room for it.
+    */
+   int addChannel(byte pin) {
+#if defined(A0)
+      if (pin >= A0) { pin -= A0; }
+#endif
+      if (_count >= ADC_SCANNER_CHANNELS) {
+         return -1;
+      }
+      noInterrupts();
+      byte channel = _count++;
+      _pins[channel] = pin;
+      _filtered[channel] = 0;
+      _primed[channel] = false;
+      if (channel == 0) {
+         start();
+      }
+      interrupts();
+      return channel;
+   }
+
+   /** Whether the first value of a channel has been converted. */
+   bool isReady(byte channel) const { return _primed[channel]; }
+
+   /** The last value of a channel with the full resolution of BITS bits. */
+   word readPrecise(byte channel) const {
+      byte oldSREG = SREG;
+      cli();
+      word acc = _filtered[channel];
+      SREG = oldSREG;
+      return acc >> ADC_SCANNER_FILTER;
+   }
+
+   /** The last value of a channel in the 0..1023 range of `analogRead()`. */
+   word read(byte channel) const {
+      return readPrecise(channel) >> ADC_SCANNER_OVERSAMPLING;
+   }
+
+   /** Process a conversion. To be invoked from the ADC interrupt. */
+   void handle() {
+      word sample = ADC;
+      if (_samples++ > 0) { // the first sample after switching is discarded
+         _sum += sample;
+      }
+      if (_samples > SAMPLES) {
+         word value = _sum >> ADC_SCANNER_OVERSAMPLING;
+         if (_primed[_current]) {
+            _filtered[_current] += value - (_filtered[_current] >> ADC_SCANNER_FILTER);
+         } else {
+            _filtered[_current] = value << ADC_SCANNER_FILTER;
+            _primed[_current] = true;
+         }
+         _current = (_current + 1 < _count) ? _current + 1 : 0;
+         _samples = 0;
+         _sum = 0;
+         selectChannel(_pins[_current]);
+      }
+      ADCSRA |= _BV(ADSC);
+   }
+
+private:
+
+   // Fails to compile if the filtered values don't fit in a word
+   typedef char FilterCheck[
+      (BITS + ADC_SCANNER_FILTER <= 16) ? 1 : -1];
+
+   // Fails to compile if there are no channels or too many of them
+   typedef char ChannelsCheck[
+      (ADC_SCANNER_CHANNELS > 0 && ADC_SCANNER_CHANNELS < 256) ? 1 : -1];
+
+   byte _pins[ADC_SCANNER_CHANNELS];
+   volatile word _filtered[ADC_SCANNER_CHANNELS];
+   volatile bool _primed[ADC_SCANNER_CHANNELS];
+   volatile byte _count;
+   byte _current;
+   word _samples;
+   unsigned long _sum;
+
+   void start() {
+      _current = 0;
+      _samples = 0;
+      _sum = 0;
+      selectChannel(_pins[0]);
+      ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+      ADCSRA |= _BV(ADSC);
+   }
+
+   static void selectChannel(byte channel) {
+#if defined(MUX5)
+      if (channel >= 8) { ADCSRB |= _BV(MUX5); }
+      else { ADCSRB &= ~_BV(MUX5); }
+#endif
+      ADMUX = _BV(REFS0) | (channel & 0x07);
+   }
+};
+
+#endif
+
+#define ANALOG_INPUT_HYSTERESIS 8
+
 class AnalogInput {
 public:
 
-   AnalogInput(int pin = 0) : _pin(pin), _state(0) {}
+   AnalogInput(int pin = 0) : 
+         _pin(pin), _state(0), _from(0), _levels(1024), _dir(1), 
+         _hysteresis(ANALOG_INPUT_HYSTERESIS), _level(-1) {
+#if defined(__AVR__)
+      _scanner = 0;
+#endif
+   }
 
    void setPin(int pin) {
       _pin = pin;
    }
 
+#if defined(__AVR__)
+   /** 
+    * Read the input from an ADC scanner instead of `analogRead()`. Reads 
+    * then return the last filtered value of the scanner without blocking.
+    * Until the scanner has the first value, `read()` returns 0 and no 
+    * change is reported.
+    */
+   void setScanner(AdcScanner& scanner) {
+      int channel = scanner.addChannel(_pin);
+      if (channel >= 0) {
+         _scanner = &scanner;
+         _channel = channel;
+      }
+   }
+#endif
+
    long read() {
-      _state = analogRead(_pin);
+      _state = sample();
       return _state;
    }
 
@@ -30,9 +368,58 @@ public:
       return ::map(read(), 0, 1023, from, to);
    }
 
+   /**
+    * Quantize the input to the values from `from` to `to` (both included),
+    * which may be decreasing. The input range is divided in equal intervals,
+    * one per value. The input must get `hysteresis` units into a neighbour
+    * interval to select it, so the value doesn't flicker when the input is
+    * near a boundary. 
+    */
+   void setOutputRange(long from, long to, 
+                       word hysteresis = ANALOG_INPUT_HYSTERESIS) {
+      _from = from;
+      _dir = (to < from) ? -1 : 1;
+      _levels = (to - from) * _dir + 1;
+      _hysteresis = hysteresis;
+      _level = -1;
+   }
+
+   /** The quantized value as of the last call to `isOutputChanged()`. */
+   long output() const {
+      return _from + _dir * _level;
+   }
+
+   /**
+    * Sample the input and return true if its quantized value has changed. 
+    * The interval of the current value is precomputed, so the sample is 
+    * only compared with its bounds unless the value changes. 
+    */
+   bool isOutputChanged() {
+      if (!isReady()) {
+         return false;
+      }
+      int input = sample();
+      if (_level >= 0 && input + int(_hysteresis) >= _low && 
+            input < _high + int(_hysteresis)) {
+         return false;
+      }
+      long level = long(input) * _levels / 1024;
+      if (level == _level) {
+         return false;
+      }
+      _state = input;
+      _level = level;
+      _low = (level == 0) ? 0 : bound(level);
+      _high = (level == _levels - 1) ? 1024 : bound(level + 1);
+      return true;
+   }
+
    bool isChanged(long tolerance = 16) {
+      if (!isReady()) {
+         return false;
+      }
       long prevState = _state;
-      long newState = analogRead(_pin);
+      long newState = sample();
       if ((prevState <= newState && (newState - prevState) > tolerance) ||
           (prevState > newState && (prevState - newState) > tolerance)) {
          _state = newState;
@@ -45,8 +432,51 @@ private:
 
    int _pin;
    long _state;
+   long _from;
+   long _levels;
+   signed char _dir;
+   word _hysteresis;
+   long _level;
+   int _low;   // first input of current level
+   int _high;  // first input of next level
+#if defined(__AVR__)
+   AdcScanner* _scanner;
+   byte _channel;
+#endif
+
+   /** The first input of given output level. */
+   int bound(long level) const {
+      return (level * 1024 + _levels - 1) / _levels;
+   }
+
+   /** Whether there is a value to read, i.e. the scanner has one. */
+   bool isReady() const {
+#if defined(__AVR__)
+      if (_scanner) {
+         return _scanner->isReady(_channel);
+      }
+#endif
+      return true;
+   }
+
+   long sample() const {
+#if defined(__AVR__)
+      if (_scanner) {
+         return _scanner->read(_channel);
+      }
+#endif
+      return analogRead(_pin);
+   }
 };
 
 }
 
+#if defined(__AVR__) && defined(OAC_ADC_SCANNER)
+
+OAC::AdcScanner OACADC;
+
+ISR(ADC_vect) { OACADC.handle(); }
+
+#endif
+
 #endif
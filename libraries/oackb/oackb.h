@@ -11,9 +11,39 @@
 #define OAC_KB_H
 
 #include <arduino.h>
+#include <oacio.h>
+#include <oacring.h>
+
+/** 
+ * Default time given to a controller to drive the bus after its OE signal
+ * is asserted, in microseconds. 
+ */
+#define KEYPAD_SETTLE_MICROS 1000
+
+/** The number of key events the keypad can queue. Must be a power of 2. */
+#define KEYPAD_EVENT_QUEUE_SIZE 16
+
+/** Default time a key is held before it repeats, in milliseconds. */
+#define KEYPAD_REPEAT_DELAY 500
+
+/** Default time between repetitions of a held key, in milliseconds. */
+#define KEYPAD_REPEAT_INTERVAL 100
 
 namespace OAC {
 
+enum KeyEventType {
+   KEY_PRESSED,
+   KEY_RELEASED,
+   KEY_REPEATED,
+};
+
+/** A key press or release. */
+struct KeyEvent {
+   short key;
+   byte type;
+   unsigned long time; // in milliseconds, as given by millis()
+};
+
 /** 
  * A keypad controlled by OAC Keypad expansion cards. 
  * 
@@ -36,12 +66,22 @@ namespace OAC {
  *   <li>Controller configuration. For each connected controller, the user
  *       indicates what pins correspond to the DAV and the OE signals using
  *       the configController() function. 
+ *    <li>Next event. Using nextEvent() function, the user code retrieves
+ *        the presses and releases of the keys in the order they happened.
  *    <li>Read key. Using readKey() function, the user code can interrogate
- *        what's the currenty pressed key.
+ *        what's the currenty pressed key. 
  *    <li>Read key type. Using readKeyType() function, the user code can
  *        interrogate what's the last key type (key pressed and then released).
  * </ul>
  *
+ * The DAV lines are sampled on each call to these functions, or from an 
+ * interrupt handler with sampleDav(). Each controller is tracked on its
+ * own, so keys pressed at the same time in different controllers are all
+ * reported. The key of a controller is read from the bus in a later call,
+ * once its OE signal has been asserted for the settle time (see 
+ * setSettleTime()), so these functions never block. They should be called
+ * on every loop. 
+ *
  * Important note: the keys are numbered in consecutive ranges respect the
  * index of its controller. I.e., CONTROLLER_0 keys goes from 0 to 15, 
  * CONTROLLER_1 goes from 16 to 31, and so. 
@@ -60,7 +100,16 @@ public:
       CONTROLLER_7 = 7,
    };
 
-   Keypad() : status(0), lastKey(-1) {
+   Keypad() : 
+         status(0), davInOrder(true), davLevels(0), davRose(0), davFell(0), 
+         selected(NONE), settleMicros(KEYPAD_SETTLE_MICROS), 
+         measuredSettleMicros(0), lostEvents(0), queueEvents(false), 
+         repeatDelay(KEYPAD_REPEAT_DELAY), 
+         repeatInterval(KEYPAD_REPEAT_INTERVAL) {
+      for (byte i = 0; i < sizeof(repeatingKeys); i++) {
+         repeatingKeys[i] = 0;
+      }
+      bus.configured = false;
       bus.a = bus.b = bus.c = bus.d = -1;
    }
 
@@ -89,6 +138,12 @@ public:
       pinMode(bus.c, INPUT);
       pinMode(bus.d, INPUT);
 
+      bus.pins.clear();
+      bus.pins.addPin(a);
+      bus.pins.addPin(b);
+      bus.pins.addPin(c);
+      bus.pins.addPin(d);
+
       return true;
    }
 
@@ -115,47 +170,113 @@ public:
       status |= (1 << index);
       controller[index].davPin = dav;
       controller[index].oePin = oe;
+      controller[index].state = KEY_UP;
 
       pinMode(dav, INPUT);
       if (oe >= 0) {
         pinMode(oe, OUTPUT);
         digitalWrite(oe, HIGH);
       }
+      configDavPins();
 
       return true;
    }
 
+   /**
+    * Set the time in microseconds given to a controller to drive the bus
+    * after its OE signal is asserted. 
+    */
+   void setSettleTime(unsigned long us) {
+      settleMicros = us;
+   }
+
+   /** 
+    * The longest time in microseconds the bus was seen changing after
+    * an OE signal was asserted. It may be used to tune `setSettleTime()`.
+    * The resolution is limited by the frequency the keypad is updated.
+    */
+   unsigned long maxSettleTime() const {
+      return measuredSettleMicros;
+   }
+
+   /**
+    * Enable or disable the repetition of a key. While a repeating key is 
+    * held, `KEY_REPEATED` events are generated after the repeat delay and
+    * then on each repeat interval. Keys don't repeat by default. 
+    */
+   void setKeyRepeat(short key, bool repeat) {
+      if (key < 0 || key >= 128) {
+         return;
+      }
+      if (repeat) { repeatingKeys[key / 8] |= 1 << (key % 8); }
+      else { repeatingKeys[key / 8] &= ~(1 << (key % 8)); }
+   }
+
+   /** Set the repeat delay and interval in milliseconds. */
+   void setRepeatTiming(unsigned int initialDelay, unsigned int interval) {
+      repeatDelay = initialDelay;
+      repeatInterval = interval;
+   }
+
+   /** 
+    * The number of events lost because the queue was full or a key was 
+    * pressed and replaced by another one before it could be read. 
+    */
+   unsigned int lostKeyEvents() const {
+      return lostEvents;
+   }
+
+   /**
+    * The number of port reads needed to sample all the DAV lines and the 
+    * data bus respectively. Each one is 1 when all its pins are wired to
+    * the same port (AVR boards only).
+    */
+   byte davPortCount() const { return davPins.portCount(); }
+   byte busPortCount() const { return bus.pins.portCount(); }
+
+   /**
+    * Measure the average time in microseconds to sample the DAV lines and
+    * the data bus, which is the cost of scanning the keypad on each loop. 
+    */
+   unsigned long measureScanTime(int samples = 64) {
+      unsigned long start = micros();
+      for (int i = 0; i < samples; i++) {
+         readDav();
+         readBus();
+      }
+      return (micros() - start) / samples;
+   }
+
+   /**
+    * Sample the DAV lines and record their changes. It is called by the
+    * functions below, but it may also be invoked from the interrupt handler
+    * of the DAV pins to timestamp the changes precisely.
+    */
+   void sampleDav() {
+      recordDav(readDav());
+   }
+
+   /** 
+    * Update the keypad and retrieve the next key event. Return false if 
+    * there is none. Events are only queued after the first call, so the
+    * queue doesn't fill up if the keypad is only read with readKey(). 
+    */
+   bool nextEvent(KeyEvent& event) {
+      queueEvents = true;
+      update();
+      return events.pop(event);
+   }
+
    /**
     * Read the currently pressed key, or -1 if no key is pressed or 
-    * the bus is not properly configured. 
+    * the bus is not properly configured. If several keys are pressed,
+    * the one of the lowest controller is returned. 
     */
    short readKey() {
-      if (busIsConfigured()) {
-         for (short i = 0; i < 8; i++) {
-            boolean isActive = status & (1 << i);
-            if (isActive) {
-                int dav = digitalRead(controller[i].davPin);
-                if (dav == HIGH) {
-                  short oePin = controller[i].oePin;
-                  if (oePin >= 0) {
-                    digitalWrite(oePin, LOW);
-                    delay(50); // give time to the controller to activate the bus
-                  }
-                  
-                  short result = 0;
-                  result |= digitalRead(bus.a) << 0;
-                  result |= digitalRead(bus.b) << 1;
-                  result |= digitalRead(bus.c) << 2;
-                  result |= digitalRead(bus.d) << 3;
-                  result += i * 0x10;
-                  
-                  if (oePin >= 0) {
-                    digitalWrite(controller[i].oePin, HIGH);
-                  }
-
-                  return result;
-               }
-            }
+      update();
+      for (byte i = 0; i < 8; i++) {
+         if ((status & (1 << i)) && controller[i].state == KEY_DOWN) {
+            return controller[i].key;
          }
       }
       return -1;
@@ -163,20 +284,38 @@ public:
 
    /**
     * Read a key type. A key type means a key is pressed and then released. 
-    * It returns the typed key, or -1 if no type is detected. 
+    * It returns the typed key, or -1 if no type is detected. Press events
+    * are discarded, and repetitions of a held key are returned as types. 
     */
    short readKeyType() {
-      short key = readKey();
-      short result = (key < 0 && lastKey >= 0) ? lastKey : -1;
-      lastKey = key;
-      return result;
+      KeyEvent event;
+      while (nextEvent(event)) {
+         if (event.type != KEY_PRESSED) {
+            return event.key;
+         }
+      }
+      return -1;
    }
 
 private:
 
+   enum { NONE = 0xff };
+
+   enum KeyState {
+      KEY_UP,       // no key is pressed
+      KEY_PENDING,  // a key is pressed but not read yet
+      KEY_DOWN,     // a key is pressed and reported
+   };
+
    struct Controller {
       short davPin;
       short oePin;
+      byte state;
+      bool releasePending;
+      short key;
+      unsigned long pressTime;
+      unsigned long releaseTime;
+      unsigned long repeatTime;
    };
 
    struct Bus {
@@ -185,12 +324,231 @@ private:
       short b;
       short c;
       short d;
+      PinGroup<4> pins;
    };
 
    byte status;
    Bus bus;
    Controller controller[8];
-   short lastKey;
+
+   // The DAV pins of the configured controllers, in index order
+   PinGroup<8> davPins;
+   byte davController[8];
+   boolean davInOrder;
+   RingBuffer<KeyEvent, KEYPAD_EVENT_QUEUE_SIZE> events;
+
+   // DAV changes, written from sampleDav() that may run in an ISR
+   volatile byte davLevels;
+   volatile byte davRose;
+   volatile byte davFell;
+   volatile unsigned long davTime[8];
+
+   // The controller using the bus, if any
+   byte selected;
+   byte lastSample;
+   unsigned long selectTime;
+   unsigned long sampleTime;
+   unsigned long settleMicros;
+   unsigned long measuredSettleMicros;
+   unsigned int lostEvents;
+   bool queueEvents;
+
+   // Bit N is set if key N repeats
+   byte repeatingKeys[16];
+   unsigned int repeatDelay;
+   unsigned int repeatInterval;
+
+   void recordDav(byte levels) {
+      byte changed = levels ^ davLevels;
+      if (changed) {
+         unsigned long now = millis();
+         for (byte i = 0; i < 8; i++) {
+            if (changed & (1 << i)) {
+               davTime[i] = now;
+            }
+         }
+         davRose |= changed & levels;
+         davFell |= changed & ~levels;
+         davLevels = levels;
+      }
+   }
+
+   /** Process the DAV changes and read the bus for pending keys. */
+   void update() {
+      if (!busIsConfigured()) {
+         return;
+      }
+      noInterrupts();
+      sampleDav();
+      byte rose = davRose;
+      byte fell = davFell;
+      byte levels = davLevels;
+      davRose = davFell = 0;
+      unsigned long times[8];
+      for (byte i = 0; i < 8; i++) {
+         times[i] = davTime[i];
+      }
+      interrupts();
+
+      for (byte i = 0; i < 8; i++) {
+         byte bit = 1 << i;
+         if (!((rose | fell) & bit)) {
+            continue;
+         }
+         Controller& c = controller[i];
+         if ((rose & fell & bit) && !(levels & bit)) {
+            // Pressed and released since the last update. A key held at
+            // the last update was released before the new one was pressed
+            if (c.state == KEY_DOWN) { onDavFell(c, times[i]); }
+            onDavRose(c, times[i]);
+            onDavFell(c, times[i]);
+         } else {
+            if (fell & bit) { onDavFell(c, times[i]); }
+            if (rose & bit) { onDavRose(c, times[i]); }
+         }
+      }
+      readPending();
+      repeatHeldKeys();
+   }
+
+   void onDavRose(Controller& c, unsigned long time) {
+      if (c.state == KEY_PENDING) {
+         // The previous key was not read, and the bus now has the new one
+         lostEvents += 2;
+      }
+      c.state = KEY_PENDING;
+      c.releasePending = false;
+      c.pressTime = time;
+   }
+
+   void onDavFell(Controller& c, unsigned long time) {
+      if (c.state == KEY_DOWN) {
+         pushEvent(c.key, KEY_RELEASED, time);
+         c.state = KEY_UP;
+      } else if (c.state == KEY_PENDING) {
+         c.releasePending = true;
+         c.releaseTime = time;
+      }
+   }
+
+   /** 
+    * Read the key of a pending controller. The key is kept in the data 
+    * outputs of a MM74C922 after DAV falls, so it is read even if the key
+    * was released. 
+    */
+   void readPending() {
+      if (selected == NONE) {
+         for (byte i = 0; i < 8; i++) {
+            if ((status & (1 << i)) && controller[i].state == KEY_PENDING) {
+               select(i);
+               break;
+            }
+         }
+      }
+      if (selected != NONE) {
+         settle();
+      }
+   }
+
+   byte readBus() const {
+      return bus.pins.read();
+   }
+
+   void configDavPins() {
+      davPins.clear();
+      for (byte i = 0; i < 8; i++) {
+         if (status & (1 << i)) {
+            davController[davPins.addPin(controller[i].davPin)] = i;
+         }
+      }
+      // Controllers 0 to N-1 map to bits 0 to N-1 as read
+      davInOrder = (status & (status + 1)) == 0;
+   }
+
+   /** Read the DAV lines, with bit N being the DAV of controller N. */
+   byte readDav() const {
+      byte bits = davPins.read();
+      if (davInOrder) {
+         return bits;
+      }
+      byte levels = 0;
+      for (byte i = 0; i < davPins.size(); i++) {
+         if (bits & (1 << i)) { levels |= 1 << davController[i]; }
+      }
+      return levels;
+   }
+
+   /** Give the bus to the controller at given index. */
+   void select(byte index) {
+      selected = index;
+      short oePin = controller[index].oePin;
+      if (oePin >= 0) {
+         digitalWrite(oePin, LOW);
+      }
+      selectTime = sampleTime = micros();
+      lastSample = readBus();
+   }
+
+   /** 
+    * Sample the bus while the selected controller settles. The time of 
+    * the last change of the bus is recorded as settle time. Controllers
+    * without OE signal are read at once. 
+    */
+   void settle() {
+      Controller& c = controller[selected];
+      unsigned long now = micros();
+      byte sample = readBus();
+      if (sample != lastSample) {
+         lastSample = sample;
+         sampleTime = now;
+      }
+      if (c.oePin >= 0 && now - selectTime < settleMicros) {
+         return;
+      }
+      unsigned long settled = sampleTime - selectTime;
+      if (settled > measuredSettleMicros) {
+         measuredSettleMicros = settled;
+      }
+      if (c.oePin >= 0) {
+         digitalWrite(c.oePin, HIGH);
+      }
+      c.key = sample + selected * 0x10;
+      c.state = KEY_DOWN;
+      c.repeatTime = c.pressTime + repeatDelay;
+      pushEvent(c.key, KEY_PRESSED, c.pressTime);
+      if (c.releasePending) {
+         pushEvent(c.key, KEY_RELEASED, c.releaseTime);
+         c.state = KEY_UP;
+      }
+      selected = NONE;
+   }
+
+   bool isRepeating(short key) const {
+      return repeatingKeys[key / 8] & (1 << (key % 8));
+   }
+
+   /** Generate the repetitions due of the held keys. */
+   void repeatHeldKeys() {
+      unsigned long now = millis();
+      for (byte i = 0; i < 8; i++) {
+         Controller& c = controller[i];
+         if ((status & (1 << i)) && c.state == KEY_DOWN && 
+               isRepeating(c.key) && long(now - c.repeatTime) >= 0) {
+            pushEvent(c.key, KEY_REPEATED, now);
+            c.repeatTime = now + repeatInterval;
+         }
+      }
+   }
+
+   void pushEvent(short key, byte type, unsigned long time) {
+      if (!queueEvents) {
+         return;
+      }
+      KeyEvent event = { key, type, time };
+      if (!events.push(event)) {
+         lostEvents++;
+      }
+   }
 };
 
 typedef Keypad Keyboard;
@@ -28,9 +28,17 @@
 #define MAX7219_SHUTDOWN_ADDR      0x0c
 #define MAX7219_DISPLAY_TEST_ADDR  0x0f
 
+#define MAX7219_MAX_INTENSITY      0x0f
+
 #define MAX7219_NO_DECODE          0
 #define MAX7219_CODE_B             1
 
+#define MAX7219_CONTROL_REGS       5
+#define MAX7219_DIGITS             8
+
+#define MAX7219_REFRESH_IMMEDIATE  0
+#define MAX7219_REFRESH_DEFERRED   1
+
 namespace OAC {
 
 template <int NCHIPS>
@@ -43,9 +51,28 @@ public:
       friend class Max7219;
      
       void setDigit(byte digit, byte value, boolean dotPoint = false) {
-         if (digit > 8) { digit = 8; }
+         if (digit >= MAX7219_DIGITS) { digit = MAX7219_DIGITS - 1; }
          if (bitRead(_decode_mode, digit) && dotPoint) { value |= 0x80; }
-         _parent->writeRegister(MAX7219_DIGIT0_ADDR + digit, value, _index);
+         if (bitRead(_loaded, digit) && _digits[digit] == value) { 
+            return; 
+         }
+         _digits[digit] = value;
+         bitSet(_loaded, digit);
+         if (_parent->_refresh_mode == MAX7219_REFRESH_DEFERRED) {
+            bitSet(_pending, digit);
+         } else {
+            _parent->writeRegister(MAX7219_DIGIT0_ADDR + digit, value, _index);
+            bitClear(_pending, digit);
+         }
+      }
+
+      /** The number of digits written but not sent to the chip yet. */
+      byte pendingDigits() const {
+         byte count = 0;
+         for (byte pending = _pending; pending; pending &= pending - 1) {
+            count++;
+         }
+         return count;
       }
        
       void writeInt(unsigned long num, byte from = 0, byte digits = 8) {
@@ -88,25 +115,56 @@ public:
       void setIntensity(float value) {
          if (value > 1.0f) { value = 1.0f; }
          if (value < 0.0f) { value = 0.0f; }
-         byte data = 0x0f * value;
-         _parent->writeRegister(MAX7219_INTENSITY_ADDR, data, _index);
+         setIntensityLevel(0x0f * value);
+      }
+
+      /** Set the intensity as a level from 0 (min) to 15 (max). */
+      void setIntensityLevel(byte level) {
+         if (level > MAX7219_MAX_INTENSITY) { level = MAX7219_MAX_INTENSITY; }
+         _fading = false;
+         writeControl(MAX7219_INTENSITY_ADDR, level);
+      }
+
+      /** 
+       * Fade the intensity to the given level (0 to 15) in the given 
+       * time in milliseconds. The fade progresses on each call to 
+       * `Max7219::updateFade()`. 
+       */
+      void fadeIntensity(byte level, word duration, unsigned long now = millis()) {
+         if (level > MAX7219_MAX_INTENSITY) { level = MAX7219_MAX_INTENSITY; }
+         byte slot = controlSlot(MAX7219_INTENSITY_ADDR);
+         if (!bitRead(_synced, slot) || duration == 0) {
+            setIntensityLevel(level);
+            return;
+         }
+         byte current = _control[slot];
+         byte steps = (level > current) ? level - current : current - level;
+         _fading = steps > 0;
+         _fade_target = level;
+         _fade_period = steps ? duration / steps : 0;
+         _fade_mark = now;
+      }
+
+      /** Return true if the intensity of this chip is fading. */
+      boolean isFading() const {
+         return _fading;
       }
        
       void setScanLimit(byte limit) {
          if (limit > 8) { limit = 8; }
-         _parent->writeRegister(MAX7219_SCAN_LIMIT_ADDR, limit, _index);
+         writeControl(MAX7219_SCAN_LIMIT_ADDR, limit);
       }
        
       void setDecodeMode(byte digit, byte mode) {
          setDigitDecodeMode(digit, mode);
-         _parent->writeRegister(MAX7219_DECODE_MODE_ADDR, _decode_mode, _index);
+         writeControl(MAX7219_DECODE_MODE_ADDR, _decode_mode);
       }
        
       void setDecodeMode(byte from_digit, byte to_digit, byte mode) {
          for (int digit = from_digit; digit < to_digit + 1; digit++) {
            setDigitDecodeMode(digit, mode);
          }
-         _parent->writeRegister(MAX7219_DECODE_MODE_ADDR, _decode_mode, _index);
+         writeControl(MAX7219_DECODE_MODE_ADDR, _decode_mode);
       }
        
       void setAllDecodeMode(byte mode) {
@@ -114,25 +172,90 @@ public:
       }
        
       void start() {
-         _parent->writeRegister(MAX7219_SHUTDOWN_ADDR, 1, _index);
+         writeControl(MAX7219_SHUTDOWN_ADDR, 1);
       }
        
       void shutdown() {
-         _parent->writeRegister(MAX7219_SHUTDOWN_ADDR, 0, _index);
+         writeControl(MAX7219_SHUTDOWN_ADDR, 0);
       }
        
       void displayTest(boolean active = true) {
-         _parent->writeRegister(MAX7219_DISPLAY_TEST_ADDR, active ? 1 : 0, _index);
+         writeControl(MAX7219_DISPLAY_TEST_ADDR, active ? 1 : 0);
       }
      
    private:
   
-      Chip() : _parent(0), _index(0), _decode_mode(0) {}
+      Chip() : _parent(0), _index(0), _decode_mode(0), _synced(0), 
+               _loaded(0), _pending(0), _fading(false) {}
        
       void init(Max7219* parent, byte index) { 
          _parent = parent;
          _index = index; 
       }
+
+      /** The slot of the register shadow for given control register. */
+      static byte controlSlot(byte reg) {
+         return (reg == MAX7219_DISPLAY_TEST_ADDR) ? 
+            MAX7219_CONTROL_REGS - 1 : reg - MAX7219_DECODE_MODE_ADDR;
+      }
+
+      /** Return true if the chip is known to hold data in given register. */
+      boolean controlIs(byte reg, byte data) const {
+         byte slot = controlSlot(reg);
+         return bitRead(_synced, slot) && _control[slot] == data;
+      }
+
+      /** Remember that the chip holds data in given control register. */
+      void syncControl(byte reg, byte data) {
+         byte slot = controlSlot(reg);
+         _control[slot] = data;
+         bitSet(_synced, slot);
+      }
+
+      /** 
+       * Pop the command to update the lowest pending digit, or a no-op
+       * command if there is no pending digit. 
+       */
+      word popPendingDigit() {
+         if (!_pending) { 
+            return MAX7219_NOOP_ADDR; 
+         }
+         byte digit = 0;
+         while (!bitRead(_pending, digit)) { digit++; }
+         bitClear(_pending, digit);
+         return (word(MAX7219_DIGIT0_ADDR + digit) << 8) | _digits[digit];
+      }
+
+      /** 
+       * Step the intensity fade up to the given time. Return the command
+       * to update the intensity register, or a no-op command if the 
+       * intensity level is not changed. 
+       */
+      word stepFade(unsigned long now) {
+         byte slot = controlSlot(MAX7219_INTENSITY_ADDR);
+         byte level = _control[slot];
+         if (!_fading) {
+            return MAX7219_NOOP_ADDR;
+         }
+         while (level != _fade_target && now - _fade_mark >= _fade_period) {
+            level += (level < _fade_target) ? 1 : -1;
+            _fade_mark += _fade_period;
+         }
+         _fading = level != _fade_target;
+         if (level == _control[slot]) {
+            return MAX7219_NOOP_ADDR;
+         }
+         syncControl(MAX7219_INTENSITY_ADDR, level);
+         return (word(MAX7219_INTENSITY_ADDR) << 8) | level;
+      }
+
+      /** Write a control register unless the chip already holds data. */
+      void writeControl(byte reg, byte data) {
+         if (!controlIs(reg, data)) {
+            _parent->writeRegister(reg, data, _index);
+            syncControl(reg, data);
+         }
+      }
        
       void setDigitDecodeMode(byte digit, byte mode) {
          if (mode) { bitSet(_decode_mode, digit); } 
@@ -142,9 +265,19 @@ public:
       Max7219* _parent;
       byte     _index;
       byte     _decode_mode;
+      byte     _control[MAX7219_CONTROL_REGS];
+      byte     _synced;
+      byte     _digits[MAX7219_DIGITS];
+      byte     _loaded;
+      byte     _pending;
+      boolean  _fading;
+      byte     _fade_target;
+      word     _fade_period;
+      unsigned long _fade_mark;
    };
 
-   Max7219() : _din(-1), _load(-1), _clock(-1) {
+   Max7219() : _din(-1), _load(-1), _clock(-1), 
+               _refresh_mode(MAX7219_REFRESH_IMMEDIATE), _shiftedBits(0) {
       for (int i = 0; i < NCHIPS; i++) {
          _chips[i].init(this, i);
       }
@@ -161,14 +294,113 @@ public:
     
       digitalWrite(_clock, LOW);
       digitalWrite(_load, HIGH);
-    
+
+      // The state of the chips is unknown after power-up, so the
+      // register shadows are discarded and every register is written.
+      for (int i = 0; i < NCHIPS; i++) {
+         _chips[i]._synced = 0;
+         _chips[i]._loaded = 0;
+         _chips[i]._pending = 0;
+      }
+      setIntensity(1.0f);
+      setScanLimit(7);
+      setAllDecodeMode(MAX7219_CODE_B);
+      displayTest(false);
+      shutdown();
+   }
+
+   /** Set the intensity of all chips in the chain. */
+   void setIntensity(float value) {
+      if (value > 1.0f) { value = 1.0f; }
+      if (value < 0.0f) { value = 0.0f; }
+      setIntensityLevel(0x0f * value);
+   }
+
+   /** Set the intensity level (0 to 15) of all chips in the chain. */
+   void setIntensityLevel(byte level) {
+      if (level > MAX7219_MAX_INTENSITY) { level = MAX7219_MAX_INTENSITY; }
+      for (int i = 0; i < NCHIPS; i++) {
+         _chips[i]._fading = false;
+      }
+      broadcastControl(MAX7219_INTENSITY_ADDR, level);
+   }
+
+   /** 
+    * Fade the intensity of all chips in the chain to the given level 
+    * (0 to 15) in the given time in milliseconds. If the duration is 0, 
+    * or no chip has a known intensity to fade from, the level is set at 
+    * once in a single frame. 
+    */
+   void fadeIntensity(byte level, word duration, unsigned long now = millis()) {
+      byte slot = Chip::controlSlot(MAX7219_INTENSITY_ADDR);
+      boolean known = false;
+      for (int i = 0; i < NCHIPS; i++) {
+         known = known || bitRead(_chips[i]._synced, slot);
+      }
+      if (duration == 0 || !known) {
+         setIntensityLevel(level);
+         return;
+      }
+      for (int i = 0; i < NCHIPS; i++) {
+         _chips[i].fadeIntensity(level, duration, now);
+      }
+   }
+
+   /**
+    * Step the intensity fades of the chips in the chain. 
+    * 
+    * This must be invoked from `loop()` while fading. It never blocks: 
+    * the intensity registers of all chips whose level changed are 
+    * updated in a single frame, and no frame is sent if no level 
+    * changed. Return true if any chip is still fading.
+    */
+   boolean updateFade(unsigned long now = millis()) {
+      word cmds[NCHIPS];
+      boolean changed = false;
+      boolean fading = false;
+      for (int i = 0; i < NCHIPS; i++) {
+         cmds[i] = _chips[i].stepFade(now);
+         changed = changed || (cmds[i] != MAX7219_NOOP_ADDR);
+         fading = fading || _chips[i].isFading();
+      }
+      if (changed) {
+         digitalWrite(_load, LOW);
+         for (int i = NCHIPS - 1; i >= 0; i--) {
+            serialWriteWord(cmds[i]);
+         }
+         digitalWrite(_load, HIGH);
+      }
+      return fading;
+   }
+
+   /** Set the scan limit of all chips in the chain. */
+   void setScanLimit(byte limit) {
+      if (limit > 8) { limit = 8; }
+      broadcastControl(MAX7219_SCAN_LIMIT_ADDR, limit);
+   }
+
+   /** Set the decode mode of all digits of all chips in the chain. */
+   void setAllDecodeMode(byte mode) {
+      byte decode_mode = mode ? 0xff : 0x00;
       for (int i = 0; i < NCHIPS; i++) {
-         _chips[i].setIntensity(1.0f);
-         _chips[i].setScanLimit(7);
-         _chips[i].setAllDecodeMode(MAX7219_CODE_B);
-         _chips[i].displayTest(false);
-         _chips[i].shutdown();
+         _chips[i]._decode_mode = decode_mode;
       }
+      broadcastControl(MAX7219_DECODE_MODE_ADDR, decode_mode);
+   }
+
+   /** Start (turn on) all chips in the chain. */
+   void start() {
+      broadcastControl(MAX7219_SHUTDOWN_ADDR, 1);
+   }
+
+   /** Shutdown (turn off) all chips in the chain. */
+   void shutdown() {
+      broadcastControl(MAX7219_SHUTDOWN_ADDR, 0);
+   }
+
+   /** Activate or deactivate the display test in all chips in the chain. */
+   void displayTest(boolean active = true) {
+      broadcastControl(MAX7219_DISPLAY_TEST_ADDR, active ? 1 : 0);
    }
     
    boolean isConfigured() const {
@@ -182,8 +414,7 @@ public:
    void serialWrite(word data, byte chip = 0) {
       digitalWrite(_load, LOW);
       serialWriteNoop(NCHIPS - chip - 1);
-      shiftOut(_din, _clock, MSBFIRST, (data >> 8));
-      shiftOut(_din, _clock, MSBFIRST, data);
+      serialWriteWord(data);
       serialWriteNoop(chip);
       digitalWrite(_load, HIGH);
    }
@@ -192,6 +423,77 @@ public:
       word cmd = (word(reg) << 8) | word(data);
       serialWrite(cmd, chip);
    }
+
+   /** 
+    * Write the given register of all chips in a single frame. 
+    * 
+    * Each chip in the chain receives the same command, so the whole 
+    * chain is updated with as many bits as a single write to one chip.
+    */
+   void writeRegisterAll(byte reg, byte data) {
+      word cmd = (word(reg) << 8) | word(data);
+      digitalWrite(_load, LOW);
+      for (int i = 0; i < NCHIPS; i++) {
+         serialWriteWord(cmd);
+      }
+      digitalWrite(_load, HIGH);
+   }
+
+   /**
+    * Set the refresh mode of the chain.
+    * 
+    * In MAX7219_REFRESH_IMMEDIATE mode (the default), each digit is sent
+    * to its chip as soon as it is set. In MAX7219_REFRESH_DEFERRED mode,
+    * digits are queued and sent by `refresh()`. Switching back to 
+    * immediate mode flushes any queued digit. 
+    */
+   void setRefreshMode(byte mode) {
+      _refresh_mode = mode;
+      if (mode == MAX7219_REFRESH_IMMEDIATE) {
+         flush();
+      }
+   }
+
+   /**
+    * Send queued digits to the chain for at most `budget` microseconds.
+    * 
+    * Each frame updates one pending digit on every chip at once, so a
+    * chain needs as many frames as digits are pending in its busiest 
+    * chip. At least one frame is sent on each call when there are 
+    * pending digits. Return the number of frames still queued.
+    */
+   byte refresh(unsigned long budget) {
+      unsigned long start = micros();
+      byte frames = pendingFrames();
+      while (frames > 0) {
+         writePendingFrame();
+         frames--;
+         if (micros() - start >= budget) { break; }
+      }
+      return frames;
+   }
+
+   /** Send all queued digits to the chain. */
+   void flush() {
+      for (byte frames = pendingFrames(); frames > 0; frames--) {
+         writePendingFrame();
+      }
+   }
+
+   /** The number of frames required to send all queued digits. */
+   byte pendingFrames() const {
+      byte frames = 0;
+      for (int i = 0; i < NCHIPS; i++) {
+         byte digits = _chips[i].pendingDigits();
+         if (digits > frames) { frames = digits; }
+      }
+      return frames;
+   }
+
+   /** The number of bits shifted to the chain since it was created. */
+   unsigned long shiftedBits() const {
+      return _shiftedBits;
+   }
     
 private:
 
@@ -199,11 +501,48 @@ private:
    byte _load;
    byte _clock;
    Chip _chips[NCHIPS];
+   byte _refresh_mode;
+   unsigned long _shiftedBits;
+
+   /** Send one pending digit of each chip in a single frame. */
+   void writePendingFrame() {
+      digitalWrite(_load, LOW);
+      // The first command shifted ends up in the last chip of the chain
+      for (int i = NCHIPS - 1; i >= 0; i--) {
+         serialWriteWord(_chips[i].popPendingDigit());
+      }
+      digitalWrite(_load, HIGH);
+   }
+
+   /** 
+    * Write a control register in all chips in the chain. 
+    * 
+    * Every frame shifts a command through the whole chain, so updating
+    * one chip costs as much as updating all of them. The value is 
+    * broadcast in one frame unless every chip already holds it. 
+    */
+   void broadcastControl(byte reg, byte data) {
+      boolean synced = true;
+      for (int i = 0; i < NCHIPS; i++) {
+         synced = synced && _chips[i].controlIs(reg, data);
+      }
+      if (!synced) {
+         writeRegisterAll(reg, data);
+         for (int i = 0; i < NCHIPS; i++) {
+            _chips[i].syncControl(reg, data);
+         }
+      }
+   }
+
+   void serialWriteWord(word data) {
+      shiftOut(_din, _clock, MSBFIRST, (data >> 8));
+      shiftOut(_din, _clock, MSBFIRST, data);
+      _shiftedBits += 16;
+   }
   
    void serialWriteNoop(byte times) {
       for (int i = 0; i < times; i++) {
-         shiftOut(_din, _clock, MSBFIRST, 0); // register 0x00
-         shiftOut(_din, _clock, MSBFIRST, 0); // null data
+         serialWriteWord(MAX7219_NOOP_ADDR); // register 0x00, null data
       }
    }
 };
@@ -0,0 +1,117 @@
+/*
+ * Open Airbus Cockpit - Arduino Ring Buffer library
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OACRING_H
+#define OACRING_H
+
+#include <Arduino.h>
+
+/**
+ * Prevent the compiler from moving memory accesses across this point.
+ * Enough for a single core, where the producer is an interrupt. It is not
+ * a hardware barrier, so it doesn't order the accesses of other cores.
+ */
+#define OAC_RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+namespace OAC {
+
+/**
+ * A ring buffer of Size elements of type T for a single producer and a
+ * single consumer, typically an interrupt handler and loop(). Each index
+ * is written by one side only, so neither push() nor pop() need to disable
+ * interrupts.
+ *
+ * The buffer is meant for a single-core ISR/main split, as in the AVR 
+ * boards. It also works across threads of a host whose CPU doesn't reorder
+ * stores with other stores nor loads with other loads (e.g. x86), which is
+ * how it is stress tested, but not on weakly ordered multi-core CPUs.
+ *
+ * Size must be a power of 2, not greater than 128. One of the slots is kept
+ * free to tell a full buffer from an empty one, so it holds Size - 1
+ * elements at most.
+ */
+template <typename T, byte Size>
+class RingBuffer {
+public:
+
+  RingBuffer() : _head(0), _tail(0) {}
+
+  /**
+   * Append an element. To be invoked from the producer. Return false if the
+   * buffer is full.
+   */
+  bool push(const T& elem) {
+    byte head = _head;
+    byte next = (head + 1) & MASK;
+    if (next == _tail) {
+      return false;
+    }
+    _elems[head] = elem;
+    OAC_RING_BARRIER();
+    _head = next;
+    return true;
+  }
+
+  /**
+   * Remove the oldest element. To be invoked from the consumer. Return false
+   * if the buffer is empty.
+   */
+  bool pop(T& elem) {
+    byte tail = _tail;
+    if (tail == _head) {
+      return false;
+    }
+    OAC_RING_BARRIER();
+    elem = _elems[tail];
+    OAC_RING_BARRIER();
+    _tail = (tail + 1) & MASK;
+    return true;
+  }
+
+  /**
+   * Access the oldest element without removing it. To be invoked from the
+   * consumer. Return 0 if the buffer is empty.
+   */
+  const T* peek() const {
+    byte tail = _tail;
+    if (tail == _head) {
+      return 0;
+    }
+    OAC_RING_BARRIER();
+    return &_elems[tail];
+  }
+
+  /** Discard all the elements. To be invoked from the consumer. */
+  void clear() { _tail = _head; }
+
+  bool isEmpty() const { return _head == _tail; }
+
+  bool isFull() const { return ((_head + 1) & MASK) == _tail; }
+
+  /** The number of elements. Exact only when called from either side. */
+  byte count() const { return (_head - _tail) & MASK; }
+
+  byte capacity() const { return Size - 1; }
+
+private:
+
+  enum { MASK = Size - 1 };
+
+  // Fails to compile if Size is not a power of 2 between 2 and 128
+  typedef char SizeCheck[
+      (Size >= 2 && Size <= 128 && (Size & (Size - 1)) == 0) ? 1 : -1];
+
+  T _elems[Size];
+  volatile byte _head;
+  volatile byte _tail;
+};
+
+} // namespace OAC
+
+#endif
@@ -0,0 +1,444 @@
+/*
+ * Open Airbus Cockpit - Arduino Scheduler library
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OACSCHED_H
+#define OACSCHED_H
+
+#include <Arduino.h>
+#include <string.h>
+
+#define SCHEDULER_MAX_TASKS 12
+
+/* 
+ * Define OAC_PROFILE before including this library to keep a profile of
+ * the execution time of each task (see `TaskProfile`). 
+ */
+#define TASK_PROFILE_BUCKETS 8
+#define TASK_PROFILE_NAME_LEN 32
+
+/* 
+ * The timer wheel has TIMER_WHEEL_SLOTS slots (a power of 2) of 
+ * 1 << TIMER_WHEEL_TICK_SHIFT microseconds each (1024us by default). 
+ */
+#define TIMER_WHEEL_SLOTS 8
+#define TIMER_WHEEL_TICK_SHIFT 10
+
+/*
+ * Protothread macros, to split a function that waits into steps that are
+ * resumed on each call. See `ProtoThread`. 
+ */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define OAC_PT_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define OAC_PT_FALLTHROUGH
+#endif
+
+#define OAC_PT_BEGIN(pt) switch ((pt).line) { case 0:
+#define OAC_PT_WAIT_UNTIL(pt, cond) \
+  do { \
+    (pt).line = __LINE__; \
+    OAC_PT_FALLTHROUGH; \
+    case __LINE__: if (!(cond)) return; \
+  } while (0)
+#define OAC_PT_YIELD(pt) \
+  do { (pt).line = __LINE__; return; case __LINE__:; } while (0)
+#define OAC_PT_END(pt) } (pt).line = 0
+
+namespace OAC {
+
+typedef void (*TaskFunction)();
+
+/** The execution statistics of a task. */
+struct TaskStats {
+  unsigned long runs;
+  unsigned long overruns;   // runs that took longer than the budget
+  unsigned long worstTime;  // longest run, in microseconds
+};
+
+#if defined(OAC_PROFILE)
+
+/** 
+ * The profile of the execution time of a task, in microseconds. Bucket 0 
+ * of the histogram counts the runs shorter than 16us, and each following
+ * bucket the runs up to twice as long as the previous one. The last 
+ * bucket counts the rest (2048us or more). 
+ */
+struct TaskProfile {
+  unsigned long minTime;
+  unsigned long maxTime;
+  unsigned long totalTime;
+  unsigned long runs;
+  unsigned long buckets[TASK_PROFILE_BUCKETS];
+
+  unsigned long meanTime() const { return runs ? totalTime / runs : 0; }
+
+  void reset() {
+    minTime = 0xffffffffUL;
+    maxTime = totalTime = runs = 0;
+    for (byte i = 0; i < TASK_PROFILE_BUCKETS; i++) {
+      buckets[i] = 0;
+    }
+  }
+
+  void record(unsigned long elapsed) {
+    if (elapsed < minTime) { minTime = elapsed; }
+    if (elapsed > maxTime) { maxTime = elapsed; }
+    totalTime += elapsed;
+    runs++;
+    byte bucket = 0;
+    for (unsigned long t = elapsed >> 4; 
+         t && bucket < TASK_PROFILE_BUCKETS - 1; 
+         t >>= 1) {
+      bucket++;
+    }
+    buckets[bucket]++;
+  }
+};
+
+#endif
+
+/**
+ * A cooperative scheduler of periodic tasks.
+ *
+ * Each task is a function invoked every `period` microseconds, or on every
+ * pass of the scheduler if its period is 0. `run()` makes a pass, which
+ * invokes the tasks that are due in order of priority (higher first). A
+ * task may have a time budget in microseconds. The runs that exceed it are
+ * counted as overruns, and the longest run of each task is recorded.
+ *
+ * Tasks are never preempted: a task that takes too long delays the rest
+ * of the pass. The statistics tell which one it is. When OAC_PROFILE is
+ * defined, a detailed profile of each task is kept as well. 
+ */
+class Scheduler {
+public:
+
+  Scheduler() : _count(0) {}
+
+  /**
+   * Add a task. Return its identifier, or -1 if there is no room for it.
+   * The first run is in the next pass.
+   */
+  int addTask(TaskFunction fn,
+              unsigned long period,
+              byte priority = 0,
+              unsigned long budget = 0,
+              const char* name = 0) {
+    if (_count >= SCHEDULER_MAX_TASKS) {
+      return -1;
+    }
+    byte id = _count++;
+    Task& task = _tasks[id];
+    task.fn = fn;
+    task.period = period;
+    task.priority = priority;
+    task.budget = budget;
+    task.name = name;
+    task.next = micros();
+    resetStats(id);
+
+    // Keep the pass order sorted by priority, in order of addition for ties
+    byte pos = id;
+    while (pos > 0 && _tasks[_order[pos - 1]].priority < priority) {
+      _order[pos] = _order[pos - 1];
+      pos--;
+    }
+    _order[pos] = id;
+    return id;
+  }
+
+  /** Run the tasks that are due. To be invoked from `loop()`. */
+  void run() {
+    for (byte i = 0; i < _count; i++) {
+      Task& task = _tasks[_order[i]];
+      unsigned long start = micros();
+      if (task.period && long(start - task.next) < 0) {
+        continue;
+      }
+      task.fn();
+      unsigned long elapsed = micros() - start;
+      task.stats.runs++;
+      if (elapsed > task.stats.worstTime) {
+        task.stats.worstTime = elapsed;
+      }
+      if (task.budget && elapsed > task.budget) {
+        task.stats.overruns++;
+      }
+#if defined(OAC_PROFILE)
+      task.profile.record(elapsed);
+#endif
+      if (task.period) {
+        task.next += task.period;
+        if (long(start - task.next) >= 0) {
+          // Too late to catch up: skip the missed periods
+          task.next = start + task.period;
+        }
+      }
+    }
+  }
+
+  /** The number of tasks. */
+  byte taskCount() const { return _count; }
+
+  /** The statistics of the given task. */
+  const TaskStats& stats(byte task) const { return _tasks[task].stats; }
+
+  /** Reset the statistics of the given task. */
+  void resetStats(byte task) {
+    _tasks[task].stats.runs = 0;
+    _tasks[task].stats.overruns = 0;
+    _tasks[task].stats.worstTime = 0;
+#if defined(OAC_PROFILE)
+    _tasks[task].profile.reset();
+#endif
+  }
+
+  /** The name of the given task, or 0 if it has none. */
+  const char* taskName(byte task) const { return _tasks[task].name; }
+
+#if defined(OAC_PROFILE)
+  /** The profile of the given task. */
+  const TaskProfile& profile(byte task) const { return _tasks[task].profile; }
+
+  /**
+   * Write the profile of the named tasks as LVars, using the 
+   * `writeLVarAs<long>()` function of `out` (e.g. OACSP). The LVars are named 
+   * PROF_<task>_<stat>, being the stats MIN, MEAN, MAX, OVER (overruns) 
+   * and H0 to H7 (histogram buckets). 
+   */
+  template <typename Writer>
+  void reportProfile(Writer& out) const {
+    for (byte i = 0; i < _count; i++) {
+      const Task& task = _tasks[i];
+      if (!task.name) {
+        continue;
+      }
+      const TaskProfile& p = task.profile;
+      reportStat(out, task.name, "MIN", p.runs ? p.minTime : 0);
+      reportStat(out, task.name, "MEAN", p.meanTime());
+      reportStat(out, task.name, "MAX", p.maxTime);
+      reportStat(out, task.name, "OVER", task.stats.overruns);
+      for (byte b = 0; b < TASK_PROFILE_BUCKETS; b++) {
+        char stat[4] = { 'H', char('0' + b), 0 };
+        reportStat(out, task.name, stat, p.buckets[b]);
+      }
+    }
+  }
+#endif
+
+private:
+
+  struct Task {
+    TaskFunction fn;
+    unsigned long period;
+    unsigned long budget;
+    unsigned long next;
+    byte priority;
+    const char* name;
+    TaskStats stats;
+#if defined(OAC_PROFILE)
+    TaskProfile profile;
+#endif
+  };
+
+  Task _tasks[SCHEDULER_MAX_TASKS];
+  byte _order[SCHEDULER_MAX_TASKS];
+  byte _count;
+
+#if defined(OAC_PROFILE)
+  template <typename Writer>
+  static void reportStat(Writer& out, 
+                         const char* task, 
+                         const char* stat, 
+                         unsigned long value) {
+    char lvar[TASK_PROFILE_NAME_LEN] = "PROF_";
+    strncat(lvar, task, sizeof(lvar) - strlen(lvar) - 1);
+    strncat(lvar, "_", sizeof(lvar) - strlen(lvar) - 1);
+    strncat(lvar, stat, sizeof(lvar) - strlen(lvar) - 1);
+    out.template writeLVarAs<long>(lvar, value);
+  }
+#endif
+};
+
+/**
+ * The state of a protothread: a function that runs in steps, resuming 
+ * where it left off on each call. 
+ *
+ * The body of the function goes between OAC_PT_BEGIN() and OAC_PT_END().
+ * OAC_PT_WAIT_UNTIL() returns from the function until its condition is 
+ * true, and OAC_PT_YIELD() returns once. When the end is reached, the next
+ * call starts over. Local variables are lost when the function returns, so
+ * keep the state in members. A `switch` cannot be used in the body, and 
+ * there can be only one wait or yield per line. 
+ */
+struct ProtoThread {
+  unsigned int line;
+
+  ProtoThread() : line(0) {}
+
+  /** Start over from the beginning in the next call. */
+  void restart() { line = 0; }
+
+  /** Whether the protothread is waiting in the middle of its body. */
+  bool isWaiting() const { return line != 0; }
+};
+
+class TimerWheel;
+
+/**
+ * A timer started by a `TimerWheel`. It serves as the handle of a deadline:
+ * it is pending until its time comes, and then it is expired until it is 
+ * started again. 
+ */
+class Timer {
+public:
+
+  Timer() : _fn(0), _next(0), _due(0), _state(IDLE) {}
+
+  /** Whether the timer was started and its time has not come yet. */
+  bool isPending() const { return _state == PENDING; }
+
+  /** Whether the time of the timer has come. */
+  bool isExpired() const { return _state == EXPIRED; }
+
+private:
+
+  friend class TimerWheel;
+
+  enum State { IDLE, PENDING, EXPIRED };
+
+  TaskFunction _fn;
+  Timer* _next;
+  unsigned long _due;
+  byte _state;
+};
+
+/**
+ * A timer wheel. 
+ *
+ * Timers are kept in a ring of slots, one per tick of 1024us, according 
+ * to their deadline. `update()` only checks the slots of the ticks passed 
+ * since the previous call, so its cost depends on the timers that are
+ * about to expire rather than on all the pending ones. Timers further 
+ * than a whole turn of the wheel stay in their slot for more turns. 
+ *
+ * `update()` takes all the timers whose time has come before invoking any
+ * of their functions. A timer started from one of these functions, even 
+ * with no delay, is not expired before the next `update()`, so a function
+ * that starts its own timer again never loops. A timer cancelled or 
+ * started from one of these functions does not invoke its function in 
+ * that update. 
+ *
+ * Starting and cancelling timers is not interrupt-safe: do it from tasks. 
+ */
+class TimerWheel {
+public:
+
+  TimerWheel() : 
+      _expired(0), _lastTick(micros() >> TIMER_WHEEL_TICK_SHIFT) {
+    for (byte i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      _slots[i] = 0;
+    }
+  }
+
+  /**
+   * Start the timer, which expires after the given microseconds. The 
+   * optional function is invoked by `update()` when it expires. If the 
+   * timer was pending, it is restarted. 
+   */
+  void start(Timer& timer, unsigned long delay, TaskFunction fn = 0) {
+    cancel(timer);
+    timer._fn = fn;
+    timer._due = micros() + delay;
+    timer._state = Timer::PENDING;
+    Timer*& slot = _slots[slotOf(timer._due)];
+    timer._next = slot;
+    slot = &timer;
+  }
+
+  /** Stop the timer, if pending. It is neither pending nor expired. */
+  void cancel(Timer& timer) {
+    if (timer._state == Timer::PENDING) {
+      unlink(&_slots[slotOf(timer._due)], timer);
+    } else if (timer._state == Timer::EXPIRED) {
+      // It may be waiting for its function to be invoked by update()
+      unlink(&_expired, timer);
+    }
+    timer._state = Timer::IDLE;
+  }
+
+  /** Expire the timers whose time has come. To be invoked on every pass. */
+  void update() {
+    unsigned long now = micros();
+    unsigned long tick = now >> TIMER_WHEEL_TICK_SHIFT;
+    unsigned long ticks = tick - _lastTick;
+    if (ticks >= TIMER_WHEEL_SLOTS) {
+      ticks = TIMER_WHEEL_SLOTS - 1;
+    }
+    // The slot of the current tick is checked again until the tick ends
+    Timer** last = &_expired;
+    for (unsigned long t = tick - ticks; t != tick + 1; t++) {
+      last = expireSlot(t & (TIMER_WHEEL_SLOTS - 1), now, last);
+    }
+    _lastTick = tick;
+
+    while (_expired) {
+      Timer* timer = _expired;
+      _expired = timer->_next;
+      timer->_next = 0;
+      if (timer->_fn) {
+        timer->_fn();
+      }
+    }
+  }
+
+private:
+
+  Timer* _slots[TIMER_WHEEL_SLOTS];
+  Timer* _expired; // expired timers whose function is to be invoked
+  unsigned long _lastTick;
+
+  static byte slotOf(unsigned long time) {
+    return (time >> TIMER_WHEEL_TICK_SHIFT) & (TIMER_WHEEL_SLOTS - 1);
+  }
+
+  static void unlink(Timer** list, Timer& timer) {
+    for (Timer** t = list; *t; t = &(*t)->_next) {
+      if (*t == &timer) {
+        *t = timer._next;
+        break;
+      }
+    }
+  }
+
+  /** 
+   * Move the expired timers of the slot to the end of the expired list, 
+   * given by `last`. Return the new end of the list. 
+   */
+  Timer** expireSlot(byte slot, unsigned long now, Timer** last) {
+    Timer** t = &_slots[slot];
+    while (*t) {
+      Timer* timer = *t;
+      if (long(now - timer->_due) >= 0) {
+        *t = timer->_next;
+        timer->_state = Timer::EXPIRED;
+        timer->_next = 0;
+        *last = timer;
+        last = &timer->_next;
+      } else {
+        t = &timer->_next;
+      }
+    }
+    return last;
+  }
+};
+
+} // namespace OAC
+
+#endif
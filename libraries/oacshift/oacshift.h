@@ -11,37 +11,73 @@
 #define OACSHIFT_H
 
 #include <arduino.h>
+#include <oacio.h>
 
 namespace OAC {
 
-class Shift4021 {
+/**
+ * The integral type able to hold the bits of a chain of NBYTES shift
+ * registers. Chains longer than 4 bytes are truncated to 32 bits. 
+ */
+template <int NBYTES>
+struct ShiftBits { typedef unsigned long Type; };
+
+template <>
+struct ShiftBits<1> { typedef byte Type; };
+
+template <>
+struct ShiftBits<2> { typedef word Type; };
+
+/**
+ * Timing of the signals sent to 4021's. 
+ * 
+ * CD4021B datasheet requires pulses of at least 180ns for the clock and 
+ * 160ns for the parallel/serial control at 5V. The pins are written 
+ * through their port registers (see `FastPin`), which keeps each level
+ * for at least 4 cycles (250ns at 16MHz) in the AVR boards, so no delay
+ * is needed to honour these minimums. The data line is read about 1us
+ * after the clock rises, well beyond the 320ns of maximum propagation
+ * delay. That's the fast profile used by default. The slow
+ * profile adds some microseconds to each pulse. It may be used when the
+ * 4021's are connected through long cables with slow signal edges. 
+ */
+struct Shift4021FastTiming {
+  enum { LATCH_DELAY = 0, CLOCK_DELAY = 0 };
+};
+
+struct Shift4021SlowTiming {
+  enum { LATCH_DELAY = 20, CLOCK_DELAY = 2 };
+};
+
+template <typename Timing = Shift4021FastTiming>
+class BasicShift4021 {
 public:
 
   void setPins(int clock, int latch, int data) {
-    _clockPin = clock;
-    _latchPin = latch;
-    _dataPin = data;
-    pinMode(_clockPin, OUTPUT);
-    pinMode(_latchPin, OUTPUT);
-    pinMode(_dataPin, INPUT);
+    pinMode(clock, OUTPUT);
+    pinMode(latch, OUTPUT);
+    pinMode(data, INPUT);
+    _clockPin.setPin(clock);
+    _latchPin.setPin(latch);
+    _dataPin.setPin(data);
   }
   
   void parallelIn() {
-    digitalWrite(_latchPin, HIGH);
-    delayMicroseconds(20);
-    digitalWrite(_latchPin, LOW);
+    _latchPin.write(HIGH);
+    wait(Timing::LATCH_DELAY);
+    _latchPin.write(LOW);
   }
 
   template <typename Data>
   Data shiftBitsIn(int nbits) {
     Data data = 0;
     for (int i = nbits - 1; i >= 0; i--) {
-      data |= Data(digitalRead(_dataPin)) << i;
+      data |= Data(_dataPin.read()) << i;
   
-      digitalWrite(_clockPin, HIGH);
-      delayMicroseconds(2);
-      digitalWrite(_clockPin, LOW);
-      delayMicroseconds(2);
+      _clockPin.write(HIGH);
+      wait(Timing::CLOCK_DELAY);
+      _clockPin.write(LOW);
+      wait(Timing::CLOCK_DELAY);
     }
     return data;
   }  
@@ -53,46 +89,289 @@ public:
   word shiftWordIn() {
     return shiftBitsIn<word>(16);
   }
+
+  /**
+   * Shift in the bytes of a chain of 4021's. The first byte in `data`
+   * is read from the 4021 connected to the board, the second one from
+   * the next 4021 in the chain, and so.
+   */
+  void shiftBytesIn(byte* data, int nbytes) {
+    for (int i = 0; i < nbytes; i++) {
+      data[i] = shiftByteIn();
+    }
+  }
+
+  /**
+   * Measure the read throughput in bits per second. 
+   * 
+   * This performs `samples` reads of `nbits` bits (up to 32), including
+   * the parallel load of each read. It is intended to compare timing 
+   * profiles and chain lengths on the actual hardware. 
+   */
+  unsigned long measureThroughput(int nbits = 8, int samples = 64) {
+    unsigned long start = micros();
+    for (int i = 0; i < samples; i++) {
+      parallelIn();
+      shiftBitsIn<unsigned long>(nbits);
+    }
+    unsigned long elapsed = micros() - start;
+    unsigned long long bits = (unsigned long long)nbits * samples;
+    return elapsed ? (unsigned long)(bits * 1000000ULL / elapsed) : 0;
+  }
   
 private:
 
-  int _clockPin;
-  int _latchPin;
-  int _dataPin;  
+  FastPin _clockPin;
+  FastPin _latchPin;
+  FastPin _dataPin;  
+
+  static void wait(unsigned int us) {
+    if (us) {
+      delayMicroseconds(us);
+    }
+  }
 };
 
+typedef BasicShift4021<Shift4021FastTiming> Shift4021;
+typedef BasicShift4021<Shift4021SlowTiming> SlowShift4021;
+
+/**
+ * A chain of 595's.
+ * 
+ * The last written value is remembered, and writing it again is skipped.
+ * While shifting, the latch is kept low so the outputs of all the 595's 
+ * in the chain are updated at once when the last bit is shifted, without 
+ * showing intermediate states. The shadow is limited to 4 bytes; longer 
+ * writes are always shifted.
+ */
 class Shift595 {
 public:
 
+  Shift595() : _latchedBytes(0), _skippedWrites(0) {}
+
   void setPins(int clock, int latch, int data) {
     _clockPin = clock;
     _latchPin = latch;
     _dataPin = data;
+    _latchedBytes = 0;
     pinMode(_clockPin, OUTPUT);
     pinMode(_latchPin, OUTPUT);
     pinMode(_dataPin, OUTPUT);
   }
   
   void shiftByteOut(byte data) {
+    if (isLatched(data, 1)) { return; }
     digitalWrite(_latchPin, LOW);
     ::shiftOut(_dataPin, _clockPin, MSBFIRST, data);
     digitalWrite(_latchPin, HIGH);
   }
   
   void shiftWordOut(word data) {
+    byte first = ((byte*)&data)[0];
+    byte second = ((byte*)&data)[1];
+    if (isLatched((word(first) << 8) | second, 2)) { return; }
+    digitalWrite(_latchPin, LOW);
+    ::shiftOut(_dataPin, _clockPin, MSBFIRST, first);
+    ::shiftOut(_dataPin, _clockPin, MSBFIRST, second);
+    digitalWrite(_latchPin, HIGH);
+  }
+
+  /**
+   * Shift out the bytes of a chain of 595's. The first byte in `data`
+   * is written to the 595 connected to the board, the second one to
+   * the next 595 in the chain, and so. All the 595's are latched at 
+   * once after the last byte is shifted.
+   */
+  void shiftBytesOut(const byte* data, int nbytes) {
+    if (nbytes <= 4) {
+      unsigned long packed = 0;
+      for (int i = 0; i < nbytes; i++) {
+        packed |= (unsigned long)(data[i]) << (8 * i);
+      }
+      if (isLatched(packed, nbytes)) { return; }
+    } else {
+      _latchedBytes = 0;
+    }
     digitalWrite(_latchPin, LOW);
-    ::shiftOut(_dataPin, _clockPin, MSBFIRST, ((byte*)&data)[0]);
-    ::shiftOut(_dataPin, _clockPin, MSBFIRST, ((byte*)&data)[1]);
+    for (int i = nbytes - 1; i >= 0; i--) {
+      ::shiftOut(_dataPin, _clockPin, MSBFIRST, data[i]);
+    }
     digitalWrite(_latchPin, HIGH);
   }
+
+  /** The number of writes skipped because the value was already latched. */
+  unsigned long skippedWrites() const {
+    return _skippedWrites;
+  }
   
 private:
 
   int _clockPin;
   int _latchPin;
   int _dataPin;  
+  unsigned long _latched;
+  byte _latchedBytes;
+  unsigned long _skippedWrites;
+
+  /**
+   * Return true if the given value (the last byte to shift in the lowest
+   * position) is already latched. Otherwise remember it as latched. 
+   */
+  bool isLatched(unsigned long value, byte nbytes) {
+    if (_latchedBytes == nbytes && _latched == value) {
+      _skippedWrites++;
+      return true;
+    }
+    _latched = value;
+    _latchedBytes = nbytes;
+    return false;
+  }
+};
+
+#if defined(__AVR__)
+
+/**
+ * Binary code modulation (BCM) of the outputs of a chain of NBYTES 595's.
+ * 
+ * Each output line has a brightness level of BITS bits (from 0 to 
+ * 2^BITS - 1). The levels are stored in BITS bit planes, each one with a
+ * byte per 595. Plane P is shown for 2^P time units, so the time a line
+ * is on along a frame of 2^BITS - 1 units is proportional to its level. 
+ * 
+ * The planes are sent by `tick()`, which must be invoked from the Timer2
+ * compare match interrupt (see `SHIFT595_BCM_ISR`). On each tick, the 
+ * plane shifted in the previous tick is latched and the next plane is 
+ * shifted. As a result, the ISR only shifts and latches precomputed bytes.
+ * The time to shift the whole chain from the ISR must be shorter than a 
+ * time unit. 
+ */
+template <int NBYTES, byte BITS = 4>
+class Shift595Bcm {
+public:
+
+  enum { MAX_LEVEL = (1 << BITS) - 1 };
+
+  Shift595Bcm() : _next(0), _unit(0) {
+    setAllLevels(0);
+  }
+
+  void setPins(int clock, int latch, int data) {
+    pinMode(clock, OUTPUT);
+    pinMode(latch, OUTPUT);
+    pinMode(data, OUTPUT);
+    _clock.setPin(clock);
+    _latch.setPin(latch);
+    _data.setPin(data);
+    _latch.write(LOW);
+  }
+
+  /** Set the brightness level of the given output line. */
+  void setLevel(int line, byte level) {
+    if (level > MAX_LEVEL) { level = MAX_LEVEL; }
+    byte index = line >> 3;
+    byte mask = 1 << (line & 0x07);
+    for (byte p = 0; p < BITS; p++) {
+      if ((level >> p) & 1) { _planes[p][index] |= mask; }
+      else { _planes[p][index] &= ~mask; }
+    }
+  }
+
+  /** Get the brightness level of the given output line. */
+  byte level(int line) const {
+    byte index = line >> 3;
+    byte mask = 1 << (line & 0x07);
+    byte result = 0;
+    for (byte p = 0; p < BITS; p++) {
+      if (_planes[p][index] & mask) { result |= 1 << p; }
+    }
+    return result;
+  }
+
+  /** Set the brightness level of all output lines. */
+  void setAllLevels(byte level) {
+    if (level > MAX_LEVEL) { level = MAX_LEVEL; }
+    for (byte p = 0; p < BITS; p++) {
+      for (int i = 0; i < NBYTES; i++) {
+        _planes[p][i] = ((level >> p) & 1) ? 0xff : 0x00;
+      }
+    }
+  }
+
+  /** Set the given output line fully on or off. */
+  void setOutput(int line, boolean on) {
+    setLevel(line, on ? MAX_LEVEL : 0);
+  }
+
+  /**
+   * Start refreshing the chain from Timer2 with a time unit of (at least)
+   * the given microseconds. Return false if the time unit is too long to
+   * be counted by Timer2 for this number of bits. 
+   * 
+   * Timer2 cannot be used for other purposes (e.g. `tone()`) meanwhile.
+   */
+  bool begin(unsigned int unitMicros) {
+    static const word dividers[] = { 1, 8, 32, 64, 128, 256, 1024 };
+    unsigned long cycles = (unsigned long)unitMicros * (F_CPU / 1000000UL);
+    for (byte i = 0; i < sizeof(dividers) / sizeof(dividers[0]); i++) {
+      unsigned long counts = (cycles + dividers[i] - 1) / dividers[i];
+      if ((counts << (BITS - 1)) <= 256) {
+        noInterrupts();
+        _unit = counts ? counts : 1;
+        _next = 0;
+        shiftPlane(0);
+        TCCR2A = _BV(WGM21);  // CTC mode
+        TCCR2B = i + 1;       // CS22:0 select the divider
+        TCNT2 = 0;
+        OCR2A = _unit - 1;
+        TIMSK2 |= _BV(OCIE2A);
+        interrupts();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Stop refreshing the chain. The outputs keep the last plane. */
+  void end() {
+    TIMSK2 &= ~_BV(OCIE2A);
+  }
+
+  /** Latch the next plane. To be invoked from Timer2 COMPA interrupt. */
+  void tick() {
+    _latch.writeFromIsr(HIGH);
+    _latch.writeFromIsr(LOW);
+    byte shown = _next;
+    OCR2A = (_unit << shown) - 1;
+    _next = (shown + 1 < BITS) ? shown + 1 : 0;
+    shiftPlane(_next);
+  }
+
+private:
+
+  FastPin _clock;
+  FastPin _latch;
+  FastPin _data;
+  volatile byte _planes[BITS][NBYTES];
+  byte _next;
+  word _unit;
+
+  void shiftPlane(byte plane) {
+    for (int i = NBYTES - 1; i >= 0; i--) {
+      byte data = _planes[plane][i];
+      for (byte mask = 0x80; mask; mask >>= 1) {
+        _data.writeFromIsr(data & mask);
+        _clock.writeFromIsr(HIGH);
+        _clock.writeFromIsr(LOW);
+      }
+    }
+  }
 };
 
+/** Define the Timer2 interrupt handler that refreshes the given BCM. */
+#define SHIFT595_BCM_ISR(bcm) ISR(TIMER2_COMPA_vect) { bcm.tick(); }
+
+#endif
+
 } // namespace OAC
 
 #endif
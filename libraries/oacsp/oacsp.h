@@ -11,10 +11,12 @@
 #define OAC_OACSP_H
 
 #include "Arduino.h"
+#include <stddef.h>
 
 #define OACSP_PROTOCOL_VERSION 0x01
 #define OACSP_BUFFER_LEN 256
 #define OACSP_MAX_NAME_LEN 64
+#define OACSP_KEY_ACTION_NAME_LEN 16
 
 namespace OAC {
 
@@ -53,6 +55,43 @@ union Event {
   OffsetUpdateEvent offset;
 };
 
+enum KeyActionType {
+  KEY_ACTION_NONE,
+  KEY_ACTION_LVAR,
+  KEY_ACTION_OFFSET,
+};
+
+/**
+ * The action to perform when a key is typed. Key actions are arranged in
+ * tables stored in flash memory, where the entry of each key is found at
+ * the index given by the key code. Use the KEY_ACTION_* macros below to 
+ * declare the entries. 
+ */
+struct KeyAction {
+  short key;
+  byte type;        // a KeyActionType
+  byte length;      // an OffsetLength, for offset actions
+  word offset;
+  long value;
+  char lvar[OACSP_KEY_ACTION_NAME_LEN];
+};
+
+/** Write the given value to an LVar. */
+#define KEY_ACTION_LVAR(key, lvar, value) \
+  { key, OAC::KEY_ACTION_LVAR, 0, 0, value, lvar }
+
+/** Write the given value to an offset of given length. */
+#define KEY_ACTION_OFFSET(key, offset, len, value) \
+  { key, OAC::KEY_ACTION_OFFSET, len, offset, value, "" }
+
+/** Do nothing for a known key. */
+#define KEY_ACTION_IGNORE(key) \
+  { key, OAC::KEY_ACTION_NONE, 0, 0, 0, "" }
+
+/** An unused key code, to fill the gaps in the table. */
+#define KEY_ACTION_UNUSED \
+  { -1, OAC::KEY_ACTION_NONE, 0, 0, 0, "" }
+
 class SerialProtocol {
 public:
 
@@ -88,6 +127,48 @@ public:
     writeLVarAs<int>(lvar, value);
   }
 
+  template <typename T> 
+  void writeLVarAs(const __FlashStringHelper* lvar, T value) {
+    Serial.print("WRITE_LVAR ");
+    Serial.print(lvar);
+    Serial.print(" ");
+    Serial.print(value, DEC);
+    Serial.print('\n');
+  }
+
+  /** Write an LVar whose name is stored in flash, as in F("MY_LVAR"). */
+  void writeLVar(const __FlashStringHelper* lvar, int value) {
+    writeLVarAs<int>(lvar, value);
+  }
+
+  /**
+   * Perform the action of given key from a table of `count` key actions 
+   * stored in flash memory (PROGMEM). Return false if the table has no 
+   * entry for the key. 
+   */
+  bool writeKeyAction(const KeyAction* table, int count, short key) {
+    if (key < 0 || key >= count) {
+      return false;
+    }
+    const KeyAction* entry = &table[key];
+    KeyAction action;
+    memcpy_P(&action, entry, offsetof(KeyAction, lvar));
+    if (action.key != key) {
+      return false;
+    }
+    switch (action.type) {
+      case KEY_ACTION_LVAR:
+        writeLVarAs<long>(
+          reinterpret_cast<const __FlashStringHelper*>(entry->lvar), 
+          action.value);
+        break;
+      case KEY_ACTION_OFFSET:
+        writeOffset(action.offset, OffsetLength(action.length), action.value);
+        break;
+    }
+    return true;
+  }
+
   void writeOffset(word offset, unsigned char value) {
     writeOffset(offset, OFFSET_UINT8, value);
   }
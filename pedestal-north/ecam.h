@@ -7,22 +7,27 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
-#define ECAM_TOCFG_BTN    0x0001
-#define ECAM_ENG_BTN      0x0002
-#define ECAM_BLEED_BTN    0x0004
-#define ECAM_PRESS_BTN    0x0008
-#define ECAM_ELEC_BTN     0x0010
-#define ECAM_HYD_BTN      0x0020
-#define ECAM_FUEL_BTN     0x0040
-#define ECAM_APU_BTN      0x0080
-#define ECAM_COND_BTN     0x0100
-#define ECAM_DOOR_BTN     0x0200
-#define ECAM_WHEEL_BTN    0x0400
-#define ECAM_FCTL_BTN     0x0800
-#define ECAM_ALL_BTN      0x1000
-#define ECAM_CLR_BTN      0x2000
-#define ECAM_STS_BTN      0x4000
-#define ECAM_RCL_BTN      0x8000
+#define ECAM_TOCFG_LINE   0
+
+// The LVar written when the button at each input line changes
+const char* const ECAM_BUTTON_LVARS[] = {
+  "AB_ECAM_TOCFG",    // T.O. CONFIG
+  "AB_ECAM_page01",   // ENG
+  "AB_ECAM_page02",   // BLEED
+  "AB_ECAM_page03",   // PRESS
+  "AB_ECAM_page04",   // ELEC
+  "AB_ECAM_page05",   // HYD
+  "AB_ECAM_page06",   // FUEL
+  "AB_ECAM_page07",   // APU
+  "AB_ECAM_page08",   // COND
+  "AB_ECAM_page09",   // DOOR
+  "AB_ECAM_page10",   // WHEEL
+  "AB_ECAM_page11",   // F/CTL
+  "AB_ECAM_page12",   // ALL
+  "AB_ECAM_CLR",      // CLR
+  "AB_ECAM_page13",   // STS
+  "AB_ECAM_RCL",      // RCL
+};
 
 #define ECAM_ENG_LGT      0x0001
 #define ECAM_BLEED_LGT    0x0002
@@ -40,9 +45,24 @@
 #define ECAM_RCLR_LGT     0x2000
 #define ECAM_CLR_LGT      0x2800
 
+#define ECAM_DEBOUNCE_SAMPLES 4
+
+/* 
+ * The two expansion cards are read and written as a single chain, unless
+ * ECAM_EXP_UNCHAINED is defined and each card is driven from its own pins.
+ */
+#if defined(ECAM_EXP_UNCHAINED)
+#define ECAM_EXP_CHAINS 2
+#define ECAM_EXP_CARDS_PER_CHAIN 1
+#else
+#define ECAM_EXP_CHAINS 1
+#define ECAM_EXP_CARDS_PER_CHAIN 2
+#endif
+
 struct {
-  OAC::ExpansionCard card0;
-  OAC::ExpansionCard card1;
+  OAC::ExpansionCard<ECAM_EXP_CARDS_PER_CHAIN, 
+                     OAC::Shift4021FastTiming, 
+                     ECAM_DEBOUNCE_SAMPLES> cards[ECAM_EXP_CHAINS];
   word lights;
   word buttons;
   OAC::AnalogInput upperBright;
@@ -53,8 +73,18 @@ struct {
     buttons = 0;
     upperBright.setPin(ECAM_UPPER_ROTARY_PIN);
     lowerBright.setPin(ECAM_LOWER_ROTARY_PIN);
-    card0.setPins(ECAM_EXP0_PINS);
-    card1.setPins(ECAM_EXP1_PINS);
+    upperBright.setOutputRange(20, 0);
+    lowerBright.setOutputRange(20, 0);
+#if defined(__AVR__)
+    upperBright.setScanner(OACADC);
+    lowerBright.setScanner(OACADC);
+#endif
+#if defined(ECAM_EXP_UNCHAINED)
+    cards[0].setPins(ECAM_EXP0_PINS);
+    cards[1].setPins(ECAM_EXP1_PINS);
+#else
+    cards[0].setPins(ECAM_EXP_PINS);
+#endif
     
     OACSP.observeLVar("AB_ECAM_CLR_Light");
     OACSP.observeLVar("ECAM_MODE");
@@ -66,25 +96,34 @@ struct {
   }
   
   void processInputs() {
-    card0.readInput();
-    card1.readInput();
+    for (byte i = 0; i < ECAM_EXP_CHAINS; i++) {
+      cards[i].readInput();
+    }
 
-    // First check what buttons have been activated
-    word activated = card0.inputActivated() | 
-      (word(card1.inputActivated()) << 8);
-    sendButtonState(activated, 1);
-    
-    // Now check what buttons are deactivated
-    word deactivated = card0.inputDeactivated() | 
-      (word(card1.inputDeactivated()) << 8);
-    sendButtonState(deactivated, 0);
+    for (byte i = 0; i < ECAM_EXP_CHAINS; i++) {
+      int first = i * 8 * ECAM_EXP_CARDS_PER_CHAIN;
+
+      // First check what buttons have been activated
+      for (int line = cards[i].nextInputActivated(); 
+           line >= 0; 
+           line = cards[i].nextInputActivated(line + 1)) {
+        sendButtonState(first + line, 1);
+      }
+      
+      // Now check what buttons are deactivated
+      for (int line = cards[i].nextInputDeactivated(); 
+           line >= 0; 
+           line = cards[i].nextInputDeactivated(line + 1)) {
+        sendButtonState(first + line, 0);
+      }
+    }
     
     // Finally check the bright controls
-    if (upperBright.isChanged()) {
-      OACSP.writeLVar("AB_MPL_ECAMU_Power", upperBright.map(20, 0));
+    if (upperBright.isOutputChanged()) {
+      OACSP.writeLVar("AB_MPL_ECAMU_Power", upperBright.output());
     }
-    if (lowerBright.isChanged()) {
-      OACSP.writeLVar("AB_MPL_ECAML_Power", lowerBright.map(20, 0));
+    if (lowerBright.isOutputChanged()) {
+      OACSP.writeLVar("AB_MPL_ECAML_Power", lowerBright.output());
     }
   }
   
@@ -105,52 +144,18 @@ struct {
       lights = ev->value == 11 ? (lights | ECAM_FCTL_LGT) : (lights & ~ECAM_FCTL_LGT);
       lights = ev->value == 13 ? (lights | ECAM_STS_LGT) : (lights & ~ECAM_STS_LGT);
     }
-    card0.writeOutput(lights);
-    card1.writeOutput(lights >> 8);
+    for (byte i = 0; i < ECAM_EXP_CHAINS; i++) {
+      cards[i].writeOutput(lights >> (i * 8 * ECAM_EXP_CARDS_PER_CHAIN));
+    }
   }
 
 private:
 
-  void sendButtonState(word button, byte state) {
-    switch (button) {
-      case ECAM_TOCFG_BTN:
-        OACSP.writeLVar("AB_ECAM_TOCFG", state);
-        if (state) {
-          OACSP.writeLVar("AB_ECAM_TOconf", state); 
-        }
-        break;
-      case ECAM_ENG_BTN: 
-        OACSP.writeLVar("AB_ECAM_page01", state); break;
-      case ECAM_BLEED_BTN:
-        OACSP.writeLVar("AB_ECAM_page02", state); break;
-      case ECAM_PRESS_BTN:
-        OACSP.writeLVar("AB_ECAM_page03", state); break;
-      case ECAM_ELEC_BTN:
-        OACSP.writeLVar("AB_ECAM_page04", state); break;
-      case ECAM_HYD_BTN:
-        OACSP.writeLVar("AB_ECAM_page05", state); break;
-      case ECAM_FUEL_BTN:
-        OACSP.writeLVar("AB_ECAM_page06", state); break;
-      case ECAM_APU_BTN:
-        OACSP.writeLVar("AB_ECAM_page07", state); break;
-      case ECAM_COND_BTN:
-        OACSP.writeLVar("AB_ECAM_page08", state); break;
-      case ECAM_DOOR_BTN:
-        OACSP.writeLVar("AB_ECAM_page09", state); break;
-      case ECAM_WHEEL_BTN:
-        OACSP.writeLVar("AB_ECAM_page10", state); break;
-      case ECAM_FCTL_BTN:
-        OACSP.writeLVar("AB_ECAM_page11", state); break;
-      case ECAM_ALL_BTN:
-        OACSP.writeLVar("AB_ECAM_page12", state); break;
-      case ECAM_CLR_BTN:
-        OACSP.writeLVar("AB_ECAM_CLR", state); break;
-      case ECAM_STS_BTN:
-        OACSP.writeLVar("AB_ECAM_page13", state); break;
-      case ECAM_RCL_BTN:
-        OACSP.writeLVar("AB_ECAM_RCL", state); break;
+  void sendButtonState(int line, byte state) {
+    OACSP.writeLVar(ECAM_BUTTON_LVARS[line], state);
+    if (line == ECAM_TOCFG_LINE && state) {
+      OACSP.writeLVar("AB_ECAM_TOconf", state); 
     }
-
   }
 
 } ecam;
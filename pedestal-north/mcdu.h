@@ -81,6 +81,89 @@
 #define MCDU_KEY_OVFY      77
 #define MCDU_KEY_CLR       78
 
+/** The action of each MCDU key, indexed by key code. */
+const OAC::KeyAction MCDU_KEY_ACTIONS[] PROGMEM = {
+   KEY_ACTION_LVAR(MCDU_KEY_L1, "MCDU_LSK1L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L2, "MCDU_LSK2L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L3, "MCDU_LSK3L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L4, "MCDU_LSK4L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L5, "MCDU_LSK5L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L6, "MCDU_LSK6L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R1, "MCDU_LSK1R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R2, "MCDU_LSK2R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R3, "MCDU_LSK3R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R4, "MCDU_LSK4R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R5, "MCDU_LSK5R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R6, "MCDU_LSK6R", 1),
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_LVAR(MCDU_KEY_DIR, "MCDU1_DIR_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_PROG, "MCDU1_PROG_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_PERF, "MCDU1_PERF_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_INIT, "MCDU1_INIT_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_DATA, "MCDU1_DATA_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_FPLN, "MCDU1_FPLN_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_RADNAV, "MCDU1_RAD_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_FUELPRED, "MCDU1_FUEL_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_SECFPLN, "MCDU1_SPLN_key", 1),
+   KEY_ACTION_IGNORE(MCDU_KEY_FIX),
+   KEY_ACTION_LVAR(MCDU_KEY_MCDUMENU, "MCDU1_MENU_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_AIRPORT, "MCDU1_ARPRT_key", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_UP, "MCDU_arrowup", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_NEXTPAGE, "MCDU_arrowright", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_DOWN, "MCDU_arrowdn", 1),
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_LVAR(MCDU_KEY_1, "MCDU_1", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_2, "MCDU_2", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_3, "MCDU_3", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_4, "MCDU_4", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_5, "MCDU_5", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_6, "MCDU_6", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_7, "MCDU_7", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_8, "MCDU_8", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_9, "MCDU_9", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_DOT, "MCDU_ST", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_0, "MCDU_0", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_SLASH, "MCDU_SL", 1),
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_LVAR(MCDU_KEY_A, "MCDU_A", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_B, "MCDU_B", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_C, "MCDU_C", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_D, "MCDU_D", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_E, "MCDU_E", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_F, "MCDU_F", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_G, "MCDU_G", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_H, "MCDU_H", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_I, "MCDU_I", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_J, "MCDU_J", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_K, "MCDU_K", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_L, "MCDU_L", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_M, "MCDU_M", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_N, "MCDU_N", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_O, "MCDU_O", 1),
+   KEY_ACTION_UNUSED,
+   KEY_ACTION_LVAR(MCDU_KEY_P, "MCDU_P", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_Q, "MCDU_Q", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_R, "MCDU_R", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_S, "MCDU_S", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_T, "MCDU_T", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_U, "MCDU_U", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_V, "MCDU_V", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_W, "MCDU_W", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_X, "MCDU_X", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_Y, "MCDU_Y", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_Z, "MCDU_Z", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_MINUS, "MCDU_SGN", 1),
+   KEY_ACTION_LVAR(MCDU_KEY_PLUS, "MCDU_SGN", 1),
+   KEY_ACTION_IGNORE(MCDU_KEY_OVFY),
+   KEY_ACTION_LVAR(MCDU_KEY_CLR, "MCDU_CLR", 1),
+};
+
 struct Mcdu {
 
    OAC::Keyboard kb;
@@ -92,89 +175,24 @@ struct Mcdu {
       kb.configController(OAC::Keypad::CONTROLLER_2, MCDU_CTRL2_PINS);
       kb.configController(OAC::Keypad::CONTROLLER_3, MCDU_CTRL3_PINS);
       kb.configController(OAC::Keypad::CONTROLLER_4, MCDU_CTRL4_PINS);
+      kb.setKeyRepeat(MCDU_KEY_UP, true);
+      kb.setKeyRepeat(MCDU_KEY_DOWN, true);
+      kb.setKeyRepeat(MCDU_KEY_NEXTPAGE, true);
    }
 
    void loop() {
-      short key = kb.readKeyType();
-      switch (key) {
-         case MCDU_KEY_L1: OACSP.writeLVar("MCDU_LSK1L", 1); break;
-         case MCDU_KEY_L2: OACSP.writeLVar("MCDU_LSK2L", 1); break;
-         case MCDU_KEY_L3: OACSP.writeLVar("MCDU_LSK3L", 1); break;
-         case MCDU_KEY_L4: OACSP.writeLVar("MCDU_LSK4L", 1); break;
-         case MCDU_KEY_L5: OACSP.writeLVar("MCDU_LSK5L", 1); break;
-         case MCDU_KEY_L6: OACSP.writeLVar("MCDU_LSK6L", 1); break;
-         case MCDU_KEY_R1: OACSP.writeLVar("MCDU_LSK1R", 1); break;
-         case MCDU_KEY_R2: OACSP.writeLVar("MCDU_LSK2R", 1); break;
-         case MCDU_KEY_R3: OACSP.writeLVar("MCDU_LSK3R", 1); break;
-         case MCDU_KEY_R4: OACSP.writeLVar("MCDU_LSK4R", 1); break;
-         case MCDU_KEY_R5: OACSP.writeLVar("MCDU_LSK5R", 1); break;
-         case MCDU_KEY_R6: OACSP.writeLVar("MCDU_LSK6R", 1); break;
-
-         case MCDU_KEY_DIR: OACSP.writeLVar("MCDU1_DIR_key", 1); break;
-         case MCDU_KEY_PROG: OACSP.writeLVar("MCDU1_PROG_key", 1); break;
-         case MCDU_KEY_PERF: OACSP.writeLVar("MCDU1_PERF_key", 1); break;
-         case MCDU_KEY_INIT: OACSP.writeLVar("MCDU1_INIT_key", 1); break;
-         case MCDU_KEY_DATA: OACSP.writeLVar("MCDU1_DATA_key", 1); break;
-         case MCDU_KEY_FPLN: OACSP.writeLVar("MCDU1_FPLN_key", 1); break;
-         case MCDU_KEY_RADNAV: OACSP.writeLVar("MCDU1_RAD_key", 1); break;
-         case MCDU_KEY_FUELPRED: OACSP.writeLVar("MCDU1_FUEL_key", 1); break;
-         case MCDU_KEY_SECFPLN: OACSP.writeLVar("MCDU1_SPLN_key", 1); break;
-         case MCDU_KEY_FIX: break;
-         case MCDU_KEY_MCDUMENU: OACSP.writeLVar("MCDU1_MENU_key", 1); break;
-         case MCDU_KEY_AIRPORT: OACSP.writeLVar("MCDU1_ARPRT_key", 1); break;
-         case MCDU_KEY_UP: OACSP.writeLVar("MCDU_arrowup", 1); break;
-         case MCDU_KEY_NEXTPAGE: OACSP.writeLVar("MCDU_arrowright", 1); break;
-         case MCDU_KEY_DOWN: OACSP.writeLVar("MCDU_arrowdn", 1); break;
-
-         case MCDU_KEY_1: OACSP.writeLVar("MCDU_1", 1); break;
-         case MCDU_KEY_2: OACSP.writeLVar("MCDU_2", 1); break;
-         case MCDU_KEY_3: OACSP.writeLVar("MCDU_3", 1); break;
-         case MCDU_KEY_4: OACSP.writeLVar("MCDU_4", 1); break;
-         case MCDU_KEY_5: OACSP.writeLVar("MCDU_5", 1); break;
-         case MCDU_KEY_6: OACSP.writeLVar("MCDU_6", 1); break;
-         case MCDU_KEY_7: OACSP.writeLVar("MCDU_7", 1); break;
-         case MCDU_KEY_8: OACSP.writeLVar("MCDU_8", 1); break;
-         case MCDU_KEY_9: OACSP.writeLVar("MCDU_9", 1); break;
-         case MCDU_KEY_DOT: OACSP.writeLVar("MCDU_ST", 1); break;
-         case MCDU_KEY_0: OACSP.writeLVar("MCDU_0", 1); break;
-         case MCDU_KEY_SLASH: OACSP.writeLVar("MCDU_SL", 1); break;
-
-         case MCDU_KEY_A: OACSP.writeLVar("MCDU_A", 1); break;
-         case MCDU_KEY_B: OACSP.writeLVar("MCDU_B", 1); break;
-         case MCDU_KEY_C: OACSP.writeLVar("MCDU_C", 1); break;
-         case MCDU_KEY_D: OACSP.writeLVar("MCDU_D", 1); break;
-         case MCDU_KEY_E: OACSP.writeLVar("MCDU_E", 1); break;
-         case MCDU_KEY_F: OACSP.writeLVar("MCDU_F", 1); break;
-         case MCDU_KEY_G: OACSP.writeLVar("MCDU_G", 1); break;
-         case MCDU_KEY_H: OACSP.writeLVar("MCDU_H", 1); break;
-         case MCDU_KEY_I: OACSP.writeLVar("MCDU_I", 1); break;
-         case MCDU_KEY_J: OACSP.writeLVar("MCDU_J", 1); break;
-         case MCDU_KEY_K: OACSP.writeLVar("MCDU_K", 1); break;
-         case MCDU_KEY_L: OACSP.writeLVar("MCDU_L", 1); break;
-         case MCDU_KEY_M: OACSP.writeLVar("MCDU_M", 1); break;
-         case MCDU_KEY_N: OACSP.writeLVar("MCDU_N", 1); break;
-         case MCDU_KEY_O: OACSP.writeLVar("MCDU_O", 1); break;
+      OAC::KeyEvent event;
+      while (kb.nextEvent(event)) {
+         if (event.type != OAC::KEY_RELEASED) {
+            onKey(event.key);
+         }
+      }
+   }
 
-         case MCDU_KEY_P: OACSP.writeLVar("MCDU_P", 1); break;
-         case MCDU_KEY_Q: OACSP.writeLVar("MCDU_Q", 1); break;
-         case MCDU_KEY_R: OACSP.writeLVar("MCDU_R", 1); break;
-         case MCDU_KEY_S: OACSP.writeLVar("MCDU_S", 1); break;
-         case MCDU_KEY_T: OACSP.writeLVar("MCDU_T", 1); break;
-         case MCDU_KEY_U: OACSP.writeLVar("MCDU_U", 1); break;
-         case MCDU_KEY_V: OACSP.writeLVar("MCDU_V", 1); break;
-         case MCDU_KEY_W: OACSP.writeLVar("MCDU_W", 1); break;
-         case MCDU_KEY_X: OACSP.writeLVar("MCDU_X", 1); break;
-         case MCDU_KEY_Y: OACSP.writeLVar("MCDU_Y", 1); break;
-         case MCDU_KEY_Z: OACSP.writeLVar("MCDU_Z", 1); break;
-         case MCDU_KEY_MINUS: OACSP.writeLVar("MCDU_SGN", 1); break;
-         case MCDU_KEY_PLUS: OACSP.writeLVar("MCDU_SGN", 1); break;
-         case MCDU_KEY_OVFY: break;
-         case MCDU_KEY_CLR: OACSP.writeLVar("MCDU_CLR", 1); break;
-         default: 
-           if (key >= 0) {
-             OACSP.writeLVar("MCDU_UNKNOWN", key); 
-           }
-           break;
+   void onKey(short key) {
+      int count = sizeof(MCDU_KEY_ACTIONS) / sizeof(MCDU_KEY_ACTIONS[0]);
+      if (key >= 0 && !OACSP.writeKeyAction(MCDU_KEY_ACTIONS, count, key)) {
+         OACSP.writeLVar(F("MCDU_UNKNOWN"), key);
       }
    }
 
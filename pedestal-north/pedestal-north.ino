@@ -7,12 +7,18 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#define OAC_ADC_SCANNER
+#define OAC_PIN_CHANGE_CAPTURE
+// #define OAC_PROFILE
+
 #include <oacbtn.h>
 #include <oacenc.h>
 #include <oacexp.h>
 #include <oacio.h>
 #include <oackb.h>
 #include <oacled.h>
+#include <oacring.h>
+#include <oacsched.h>
 #include <oacsp.h>
 #include <oacshift.h>
 
@@ -24,16 +30,53 @@
 #include "mcdu.h"
 #include "radio.h"
 
+/* 
+ * Task periods and budgets in microseconds. Tasks that consume the event
+ * polled from OACSP run on every pass (period 0) after polling it. 
+ */
+#define POLL_EVENT_BUDGET    500
+#define RMP1_BUDGET          1000
+#define ECAM_OUTPUT_BUDGET   200
+#define MCDU_PERIOD          2000
+#define MCDU_BUDGET          500
+#define ECAM_INPUT_PERIOD    10000
+#define ECAM_INPUT_BUDGET    1000
+
+OAC::Scheduler scheduler;
+
+void pollEventTask() { OACSP.pollEvent(); }
+void rmp1Task() { rmp1.loop(); }
+void ecamOutputTask() { ecam.processOutputs(); }
+void mcduTask() { mcdu.loop(); }
+void ecamInputTask() { ecam.processInputs(); }
+
+#if defined(OAC_PROFILE)
+void profileTask() {
+  if (OACSP.lvarUpdateEvent("OAC_PROFILE_REPORT")) {
+    scheduler.reportProfile(OACSP);
+  }
+}
+#endif
+
 void setup() {
   OACSP.begin(DEVICE_NAME);
   ecam.setup();
   mcdu.setup();
   rmp1.setup();
+
+  scheduler.addTask(pollEventTask, 0, 3, POLL_EVENT_BUDGET, "POLL");
+  scheduler.addTask(rmp1Task, 0, 2, RMP1_BUDGET, "RMP1");
+  scheduler.addTask(ecamOutputTask, 0, 2, ECAM_OUTPUT_BUDGET, "ECAM_OUT");
+  scheduler.addTask(mcduTask, MCDU_PERIOD, 1, MCDU_BUDGET, "MCDU");
+  scheduler.addTask(
+    ecamInputTask, ECAM_INPUT_PERIOD, 0, ECAM_INPUT_BUDGET, "ECAM_IN");
+
+#if defined(OAC_PROFILE)
+  OACSP.observeLVar("OAC_PROFILE_REPORT");
+  scheduler.addTask(profileTask, 0, 0);
+#endif
 }
 
 void loop() {
-  OACSP.pollEvent();
-  ecam.loop();
-  mcdu.loop();
-  rmp1.loop();
+  scheduler.run();
 }
@@ -28,6 +28,10 @@
 // ECAM panel
 #define ECAM_UPPER_ROTARY_PIN    0
 #define ECAM_LOWER_ROTARY_PIN    1
+// Pins of the first expansion card. The second card is chained to it.
+#define ECAM_EXP_PINS            28, 30, 32, 34, 36, 38
+// Define to drive each card from its own pins, as in panels before v0.3
+// #define ECAM_EXP_UNCHAINED
 #define ECAM_EXP0_PINS           28, 30, 32, 34, 36, 38
 #define ECAM_EXP1_PINS           29, 31, 33, 35, 37, 39
 
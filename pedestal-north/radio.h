@@ -35,9 +35,22 @@
 #define RADIO_KEY_ADF      0x0c
 #define RADIO_KEY_BFO      0x0d
 
+/* 
+ * Acceleration of the RMP knobs: detents closer than the slow interval
+ * (ms) count more, up to the max multiplier at the fast interval.
+ */
+const OAC::EncoderAcceleration RADIO_INNER_ENC_ACCEL = { 80, 20, 8 };
+const OAC::EncoderAcceleration RADIO_OUTER_ENC_ACCEL = { 80, 20, 3 };
+
+void onRmp1InnerEncoderChange();
+void onRmp1OuterEncoderChange();
+
 #define RADIO_DISPLAY_MASTER  0
 #define RADIO_DISPLAY_SLAVE   1
 
+// Max time (in microseconds) spent refreshing the displays on each loop
+#define RADIO_DISPLAY_REFRESH_BUDGET  400
+
 #define RADIO_COM1_ACTIVE_OFFSET   0x034e
 #define RADIO_COM1_STANDBY_OFFSET  0x311a
 #define RADIO_COM2_ACTIVE_OFFSET   0x3118
@@ -68,6 +81,9 @@ struct RadioPanel {
             RMP1_DISPLAY_DIN_PIN, 
             RMP1_DISPLAY_LOAD_PIN, 
             RMP1_DISPLAY_CLK_PIN);
+
+         // Digits are sent a few at a time from `loop()`
+         displays.setRefreshMode(MAX7219_REFRESH_DEFERRED);
        
          // Variable `modes` store the known modes for each display.
          // We set it to default mode set by oacled library. 
@@ -81,6 +97,11 @@ struct RadioPanel {
          displays.get(RADIO_DISPLAY_MASTER).setIntensity(0.5f);
          displays.get(RADIO_DISPLAY_SLAVE).setIntensity(0.8f);       
       }
+
+      /** Send the pending digits to the displays. */
+      void loop() {
+         displays.refresh(RADIO_DISPLAY_REFRESH_BUDGET);
+      }
       
       /** Set given display to print numbers instead of text. */
       void setNumeric(Display display) {         
@@ -153,6 +174,7 @@ struct RadioPanel {
             displays.get(display).shutdown();
             displays.get(display).setDecodeMode(0, 5, mode);
             blank(display, mode);
+            displays.flush();
             displays.get(display).start();
             
             modes[display] = mode;
@@ -403,6 +425,15 @@ struct RadioPanel {
    void setupEncoders() {
       innerEncoder.setPins(RMP1_ENC_IA_PIN, RMP1_ENC_IB_PIN);
       outerEncoder.setPins(RMP1_ENC_OA_PIN, RMP1_ENC_OB_PIN);
+      innerEncoder.setAcceleration(RADIO_INNER_ENC_ACCEL);
+      outerEncoder.setAcceleration(RADIO_OUTER_ENC_ACCEL);
+#if defined(__AVR__)
+      // Decode the encoders from the pin change interrupts
+      OACPCI.attach(RMP1_ENC_IA_PIN, onRmp1InnerEncoderChange);
+      OACPCI.attach(RMP1_ENC_IB_PIN, onRmp1InnerEncoderChange);
+      OACPCI.attach(RMP1_ENC_OA_PIN, onRmp1OuterEncoderChange);
+      OACPCI.attach(RMP1_ENC_OB_PIN, onRmp1OuterEncoderChange);
+#endif
    }
   
    void setupPowerButton() {
@@ -475,11 +506,16 @@ struct RadioPanel {
    }
   
    void loop() {
+      displays.loop();
       loopPowerButton();
       if (powerBtn.state() == ON) {
          loopEncoders();
          onKey(kb.readKeyType());
          loopOffsets();
+      } else {
+         // Discard the turns while powered off
+         innerEncoder.read();
+         outerEncoder.read();
       }
    }
    
@@ -503,3 +539,6 @@ struct RadioPanel {
    }
 } rmp1;
 
+void onRmp1InnerEncoderChange() { rmp1.innerEncoder.update(); }
+
+void onRmp1OuterEncoderChange() { rmp1.outerEncoder.update(); }
@@ -22,13 +22,21 @@
 #define ENGINE_FIRE1_MASK        0x01
 #define ENGINE_FIRE2_MASK        0x04
 
+// Time for the data to be ready after DAV rises, in microseconds
+#define ENGINE_DAV_SETTLE_MICROS 20000
+
 struct Engine {
    OAC::Shift4021 in;
    OAC::Shift595 out;
    byte prevInput;
    byte output;
+   OAC::TimerWheel* timers;
+   OAC::ProtoThread inputThread;
+   OAC::Timer davSettle;
 
-   void setup() {
+   /** Set up the engine panel, which waits with timers of given wheel. */
+   void setup(OAC::TimerWheel& wheel) {
+      timers = &wheel;
       setupPins();
       setupInitialState();
       setupObservedLVars();
@@ -67,12 +75,13 @@ private:
    }
 
    void inputLoop() {
-      int dav = digitalRead(ENGINE_DAV_PIN);
-      if (dav) {
-         // Have to wait some millis to give time for data to be ready
-         delay(20);
-         processInput();
-      }
+      OAC_PT_BEGIN(inputThread);
+      OAC_PT_WAIT_UNTIL(inputThread, digitalRead(ENGINE_DAV_PIN));
+      // Have to wait some millis to give time for data to be ready
+      timers->start(davSettle, ENGINE_DAV_SETTLE_MICROS);
+      OAC_PT_WAIT_UNTIL(inputThread, davSettle.isExpired());
+      processInput();
+      OAC_PT_END(inputThread);
    }
 
    void outputLoop() {
@@ -7,12 +7,16 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+// #define OAC_PROFILE
+
 #include <oacbtn.h>
 #include <oacenc.h>
 #include <oacexp.h>
 #include <oacio.h>
 #include <oackb.h>
 #include <oacled.h>
+#include <oacring.h>
+#include <oacsched.h>
 #include <oacsp.h>
 #include <oacshift.h>
 
@@ -22,12 +26,43 @@
 
 #include "engine.h"
 
+/* 
+ * Task budgets in microseconds. The engine consumes the event polled from 
+ * OACSP, so both run on every pass. The timers are updated first. 
+ */
+#define TIMERS_BUDGET        100
+#define POLL_EVENT_BUDGET    500
+#define ENGINE_BUDGET        1000
+
+OAC::Scheduler scheduler;
+OAC::TimerWheel timers;
+
+void timersTask() { timers.update(); }
+void pollEventTask() { OACSP.pollEvent(); }
+void engineTask() { engine.loop(); }
+
+#if defined(OAC_PROFILE)
+void profileTask() {
+  if (OACSP.lvarUpdateEvent("OAC_PROFILE_REPORT")) {
+    scheduler.reportProfile(OACSP);
+  }
+}
+#endif
+
 void setup() {
   OACSP.begin(DEVICE_NAME);
-  engine.setup();
+  engine.setup(timers);
+
+  scheduler.addTask(timersTask, 0, 2, TIMERS_BUDGET, "TIMERS");
+  scheduler.addTask(pollEventTask, 0, 1, POLL_EVENT_BUDGET, "POLL");
+  scheduler.addTask(engineTask, 0, 0, ENGINE_BUDGET, "ENGINE");
+
+#if defined(OAC_PROFILE)
+  OACSP.observeLVar("OAC_PROFILE_REPORT");
+  scheduler.addTask(profileTask, 0, 0);
+#endif
 }
 
 void loop() {
-  OACSP.pollEvent();
-  engine.loop();
+  scheduler.run();
 }
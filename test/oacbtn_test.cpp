@@ -0,0 +1,46 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <oacbtn.h>
+
+#include "test.h"
+
+static int toggles = 0;
+
+static void onToggled(int) { toggles++; }
+
+/* The first event is taken even right after micros() starts. */
+static void testButtonFirstEvent() {
+   OAC::Button<HIGH, 200> button(5);
+   button.setOnToggled(onToggled);
+   toggles = 0;
+
+   OAC::PinEvent press = { 5, HIGH, 1000 };
+   CHECK(button.check(press) == HIGH);
+   CHECK(toggles == 1);
+
+   // A bounce within the debounce time is ignored
+   OAC::PinEvent bounce = { 5, LOW, 3000 };
+   CHECK(button.check(bounce) == HIGH);
+
+   // A release after the debounce time is taken
+   OAC::PinEvent release = { 5, LOW, 250000 };
+   CHECK(button.check(release) == LOW);
+   CHECK(toggles == 2);
+
+   // Events of other pins are ignored
+   OAC::PinEvent other = { 6, HIGH, 500000 };
+   CHECK(button.check(other) == LOW);
+   CHECK(toggles == 2);
+}
+
+int main() {
+   testButtonFirstEvent();
+   return TEST_RESULT();
+}
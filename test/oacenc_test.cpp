@@ -0,0 +1,44 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <oacenc.h>
+
+#include "test.h"
+
+// Clockwise cycle of the lines, as (A << 1) | B
+static const byte CYCLE[4] = { 0x0, 0x2, 0x3, 0x1 };
+
+static void update(OAC::ShiftedEncoder& encoder, byte lines) {
+   byte data[2] = { 0, byte((lines & 0x2 ? 0x02 : 0) | (lines & 0x1 ? 0x04 : 0)) };
+   encoder.update(data);
+}
+
+/* The first update takes the rest state of the lines, whatever it is. */
+static void testShiftedEncoderRestState() {
+   for (byte rest = 0; rest < 4; rest++) {
+      OAC::ShiftedEncoder encoder;
+      encoder.setLines(9, 10);
+      update(encoder, CYCLE[rest]);
+      update(encoder, CYCLE[rest]);
+      CHECK(encoder.read() == 0);
+      CHECK(encoder.missedSteps() == 0);
+
+      // A whole clockwise cycle is a detent
+      for (byte i = 1; i <= 4; i++) {
+         update(encoder, CYCLE[(rest + i) % 4]);
+      }
+      CHECK(encoder.read() == 1);
+      CHECK(encoder.missedSteps() == 0);
+   }
+}
+
+int main() {
+   testShiftedEncoderRestState();
+   return TEST_RESULT();
+}
@@ -0,0 +1,200 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <oackb.h>
+
+#include "test.h"
+
+#define BUS_PIN 10
+#define DAV_PIN 20
+#define OE_PIN  21
+
+static void setBus(byte key) {
+   for (byte i = 0; i < 4; i++) {
+      fakePins[BUS_PIN + i] = (key >> i) & 1;
+   }
+}
+
+static void configKeypad(OAC::Keypad& keypad) {
+   fakePins[DAV_PIN] = LOW;
+   keypad.configBus(BUS_PIN);
+   keypad.configController(OAC::Keypad::CONTROLLER_0, DAV_PIN, OE_PIN);
+   keypad.setSettleTime(200);
+}
+
+/** Read the next event, giving time to the bus to settle. */
+static bool waitEvent(OAC::Keypad& keypad, OAC::KeyEvent& event) {
+   for (int i = 0; i < 100; i++) {
+      if (keypad.nextEvent(event)) {
+         return true;
+      }
+      fakeMicros += 50;
+   }
+   return false;
+}
+
+/* 
+ * A key is held when the ISR sees it released and another key pressed and
+ * released before the next update: both keys must be reported in order.
+ */
+static void testReleaseBeforeNextPress() {
+   OAC::Keypad keypad;
+   OAC::KeyEvent event;
+   configKeypad(keypad);
+
+   setBus(5);
+   fakePins[DAV_PIN] = HIGH;
+   keypad.sampleDav();
+   CHECK(waitEvent(keypad, event));
+   CHECK(event.key == 5 && event.type == OAC::KEY_PRESSED);
+
+   fakePins[DAV_PIN] = LOW;
+   keypad.sampleDav();
+   setBus(7);
+   fakePins[DAV_PIN] = HIGH;
+   keypad.sampleDav();
+   fakePins[DAV_PIN] = LOW;
+   keypad.sampleDav();
+
+   CHECK(waitEvent(keypad, event));
+   CHECK(event.key == 5 && event.type == OAC::KEY_RELEASED);
+   CHECK(waitEvent(keypad, event));
+   CHECK(event.key == 7 && event.type == OAC::KEY_PRESSED);
+   CHECK(waitEvent(keypad, event));
+   CHECK(event.key == 7 && event.type == OAC::KEY_RELEASED);
+   CHECK(!waitEvent(keypad, event));
+   CHECK(keypad.lostKeyEvents() == 0);
+}
+
+/* Reading the keypad only with readKey() must not fill the event queue. */
+static void testReadKeyDoesNotQueue() {
+   OAC::Keypad keypad;
+   configKeypad(keypad);
+
+   for (byte key = 0; key < 3 * KEYPAD_EVENT_QUEUE_SIZE; key++) {
+      setBus(key % 16);
+      fakePins[DAV_PIN] = HIGH;
+      short read = -1;
+      for (int i = 0; i < 100 && read < 0; i++) {
+         read = keypad.readKey();
+         fakeMicros += 50;
+      }
+      CHECK(read == key % 16);
+      fakePins[DAV_PIN] = LOW;
+      CHECK(keypad.readKey() == -1);
+   }
+   CHECK(keypad.lostKeyEvents() == 0);
+}
+
+#define BENCH_CONTROLLERS 4
+#define BENCH_KEYS 400
+#define BENCH_LOOP_MICROS 500
+
+/* Controller N has its DAV at pin 20 + 2N and its OE at pin 21 + 2N. */
+static short benchDavPin(byte controller) { return DAV_PIN + 2 * controller; }
+static short benchOePin(byte controller) { return OE_PIN + 2 * controller; }
+
+/*
+ * Type BENCH_KEYS keys at the given rate, in keys per second, rotating 
+ * over the controllers. Each key is held for 2.5 key intervals, so it 
+ * overlaps with the keys of the next controllers. The keypad is updated 
+ * on every simulated loop of BENCH_LOOP_MICROS. Return true if every key
+ * was reported pressed and released, in order per controller, and no 
+ * event was lost. 
+ */
+static bool typeKeys(unsigned long keysPerSecond, unsigned int* lost) {
+   OAC::Keypad keypad;
+   keypad.configBus(BUS_PIN);
+   for (byte i = 0; i < BENCH_CONTROLLERS; i++) {
+      fakePins[benchDavPin(i)] = LOW;
+      keypad.configController(i, benchDavPin(i), benchOePin(i));
+   }
+
+   unsigned long interval = 1000000UL / keysPerSecond;
+   unsigned long hold = interval * 5 / 2;
+   unsigned long start = fakeMicros;
+   int pressed[BENCH_CONTROLLERS];
+   int released[BENCH_CONTROLLERS];
+   for (byte i = 0; i < BENCH_CONTROLLERS; i++) {
+      pressed[i] = released[i] = 0;
+   }
+   int reported = 0;
+   bool inOrder = true;
+
+   unsigned long end = (BENCH_KEYS - 1) * interval + hold + 100000UL;
+   for (unsigned long t = 0; t < end; t += BENCH_LOOP_MICROS) {
+      fakeMicros = start + t;
+
+      // The key of a controller is down from k * interval to k * interval
+      // + hold, being k the last key typed in that controller
+      for (byte i = 0; i < BENCH_CONTROLLERS; i++) {
+         long k = long(t / interval);
+         k -= (k % BENCH_CONTROLLERS + BENCH_CONTROLLERS - i) % 
+            BENCH_CONTROLLERS;
+         bool down = k >= 0 && k < BENCH_KEYS && t - k * interval < hold;
+         fakePins[benchDavPin(i)] = down ? HIGH : LOW;
+      }
+
+      // The controller whose OE is asserted drives the key of its last
+      // typed key to the bus, which the MM74C922 keeps after release
+      for (byte i = 0; i < BENCH_CONTROLLERS; i++) {
+         if (fakePins[benchOePin(i)] == LOW) {
+            setBus(pressed[i] * BENCH_CONTROLLERS % 16);
+         }
+      }
+
+      OAC::KeyEvent event;
+      while (keypad.nextEvent(event)) {
+         byte controller = event.key / 16;
+         int* count = (event.type == OAC::KEY_PRESSED) ? 
+            pressed : released;
+         int expected = count[controller] * BENCH_CONTROLLERS % 16;
+         if (event.key % 16 != expected || 
+               (event.type == OAC::KEY_RELEASED && 
+                  released[controller] >= pressed[controller])) {
+            inOrder = false;
+         }
+         count[controller]++;
+         if (event.type == OAC::KEY_RELEASED) {
+            reported++;
+         }
+      }
+   }
+   *lost = keypad.lostKeyEvents();
+   return inOrder && reported == BENCH_KEYS && *lost == 0;
+}
+
+/*
+ * Find the highest typing rate sustained without losing any key, in steps
+ * of 10 keys per second. A fast typist reaches about 15 keys per second.
+ */
+static void benchTyping() {
+   unsigned int lost = 0;
+   CHECK(typeKeys(20, &lost));
+   CHECK(lost == 0);
+
+   unsigned long sustained = 0;
+   for (unsigned long rate = 10; rate <= 5000; rate += 10) {
+      if (!typeKeys(rate, &lost)) {
+         break;
+      }
+      sustained = rate;
+   }
+   CHECK(sustained >= 20);
+   printf("oackb_test: %lu keys/s sustained without loss "
+      "(%d controllers, %dus loop, %dus settle time)\n", 
+      sustained, BENCH_CONTROLLERS, BENCH_LOOP_MICROS, KEYPAD_SETTLE_MICROS);
+}
+
+int main() {
+   testReleaseBeforeNextPress();
+   testReadKeyDoesNotQueue();
+   benchTyping();
+   return TEST_RESULT();
+}
@@ -0,0 +1,90 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <oacring.h>
+
+#include <chrono>
+#include <thread>
+
+#include "test.h"
+
+#define STRESS_ELEMS 2000000UL
+
+struct Sample {
+   unsigned long seq;
+   unsigned long check;
+};
+
+static void testFillAndDrain() {
+   OAC::RingBuffer<int, 8> ring;
+   int value;
+   CHECK(ring.isEmpty() && ring.capacity() == 7);
+   CHECK(ring.peek() == 0);
+   for (int i = 0; i < 7; i++) {
+      CHECK(ring.push(i));
+   }
+   CHECK(ring.isFull() && ring.count() == 7);
+   CHECK(!ring.push(7));
+   CHECK(*ring.peek() == 0);
+   for (int i = 0; i < 7; i++) {
+      CHECK(ring.pop(value) && value == i);
+   }
+   CHECK(!ring.pop(value));
+}
+
+/*
+ * A producer thread pushes a sequence while the consumer pops it. Every
+ * element must come out once, in order and completely written. The 
+ * throughput is only indicative: it is measured on the host, not on an 
+ * Arduino board. 
+ */
+static void testStress() {
+   static OAC::RingBuffer<Sample, 64> ring;
+   std::chrono::steady_clock::time_point start = 
+      std::chrono::steady_clock::now();
+
+   std::thread producer([] {
+      for (unsigned long i = 0; i < STRESS_ELEMS; ) {
+         Sample sample = { i, ~i };
+         if (ring.push(sample)) {
+            i++;
+         } else {
+            std::this_thread::yield();
+         }
+      }
+   });
+
+   unsigned long expected = 0;
+   unsigned long errors = 0;
+   Sample sample;
+   while (expected < STRESS_ELEMS) {
+      if (ring.pop(sample)) {
+         if (sample.seq != expected || sample.check != ~expected) {
+            errors++;
+         }
+         expected++;
+      } else {
+         std::this_thread::yield();
+      }
+   }
+   producer.join();
+   CHECK(errors == 0);
+   CHECK(ring.isEmpty());
+
+   double secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+   printf("oacring_test: %lu elements through the buffer, %.1f M/s "
+      "(host threads)\n", STRESS_ELEMS, STRESS_ELEMS / secs / 1e6);
+}
+
+int main() {
+   testFillAndDrain();
+   testStress();
+   return TEST_RESULT();
+}
@@ -0,0 +1,141 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <oacsched.h>
+
+#include "test.h"
+
+static int expirations = 0;
+
+static void onExpired() { expirations++; }
+
+/* Timers expire on time, also when micros() wraps around. */
+static void testTimers(unsigned long base) {
+   fakeMicros = base;
+   expirations = 0;
+   OAC::TimerWheel wheel;
+   OAC::Timer near, far, cancelled;
+   wheel.start(near, 500, onExpired);
+   wheel.start(far, 50000, onExpired);
+   wheel.start(cancelled, 2000, onExpired);
+   wheel.cancel(cancelled);
+
+   unsigned long nearTime = 0;
+   unsigned long farTime = 0;
+   for (int i = 0; i < 600; i++) {
+      fakeMicros += 100;
+      wheel.update();
+      if (near.isExpired() && !nearTime) { nearTime = fakeMicros - base; }
+      if (far.isExpired() && !farTime) { farTime = fakeMicros - base; }
+   }
+   CHECK(nearTime == 500);
+   CHECK(farTime == 50000);
+   CHECK(expirations == 2);
+   CHECK(!cancelled.isPending() && !cancelled.isExpired());
+
+   // A late update expires every timer that is due
+   OAC::Timer late;
+   wheel.start(late, 1000);
+   fakeMicros += 100000;
+   wheel.update();
+   CHECK(late.isExpired());
+}
+
+static OAC::TimerWheel callbackWheel;
+static OAC::Timer again, first, second;
+static int againRuns;
+static int secondRuns;
+
+static void onAgain() {
+   againRuns++;
+   callbackWheel.start(again, 0, onAgain);
+}
+
+static void onFirst() { callbackWheel.cancel(second); }
+
+static void onSecond() { secondRuns++; }
+
+/* Timers started or cancelled from their functions wait for an update. */
+static void testCallbacks() {
+   againRuns = 0;
+   secondRuns = 0;
+   callbackWheel.start(again, 0, onAgain);
+   for (int i = 0; i < 5; i++) {
+      fakeMicros += 100;
+      callbackWheel.update();
+      CHECK(againRuns == i + 1);
+      CHECK(again.isPending());
+   }
+   callbackWheel.cancel(again);
+
+   // A timer cancelled by the function of another one expiring in the
+   // same update doesn't invoke its function (the last started goes first)
+   callbackWheel.start(second, 500, onSecond);
+   callbackWheel.start(first, 500, onFirst);
+   fakeMicros += 5000;
+   callbackWheel.update();
+   CHECK(first.isExpired());
+   CHECK(!second.isPending() && !second.isExpired());
+   CHECK(secondRuns == 0);
+   fakeMicros += 5000;
+   callbackWheel.update();
+   CHECK(secondRuns == 0);
+}
+
+static OAC::TimerWheel threadWheel;
+static OAC::ProtoThread thread;
+static OAC::Timer settle;
+static bool ready;
+static int processed;
+
+static void waitAndProcess() {
+   OAC_PT_BEGIN(thread);
+   OAC_PT_WAIT_UNTIL(thread, ready);
+   threadWheel.start(settle, 20000);
+   OAC_PT_WAIT_UNTIL(thread, settle.isExpired());
+   processed++;
+   OAC_PT_END(thread);
+}
+
+/* A protothread waits for a condition and a timer without blocking. */
+static void testProtoThread() {
+   ready = false;
+   processed = 0;
+   for (int i = 0; i < 10; i++) {
+      fakeMicros += 1000;
+      threadWheel.update();
+      waitAndProcess();
+   }
+   CHECK(processed == 0);
+
+   ready = true;
+   for (int i = 0; i < 19; i++) {
+      fakeMicros += 1000;
+      threadWheel.update();
+      waitAndProcess();
+   }
+   CHECK(processed == 0);
+
+   // Done 20ms after the first call that saw it ready, once
+   ready = false;
+   for (int i = 0; i < 3; i++) {
+      fakeMicros += 1000;
+      threadWheel.update();
+      waitAndProcess();
+   }
+   CHECK(processed == 1);
+}
+
+int main() {
+   testTimers(0);
+   testTimers(0xffffffffUL - 15000);
+   testProtoThread();
+   testCallbacks();
+   return TEST_RESULT();
+}
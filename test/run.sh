@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Build and run the host tests of the libraries. Usage: test/run.sh [CXX]
+#
+
+cd "$(dirname "$0")"
+CXX=${1:-g++}
+INCLUDES="-Istub"
+for lib in ../libraries/*/; do
+   INCLUDES="$INCLUDES -I$lib"
+done
+mkdir -p build
+
+failed=0
+for test in *_test.cpp; do
+   name=${test%.cpp}
+   if ! $CXX -std=gnu++11 -O2 -Wall -Wextra -pthread $INCLUDES \
+         -o build/$name $test stub/Arduino.cpp; then
+      echo "$name: build failed"
+      failed=1
+   elif ! ./build/$name; then
+      echo "$name: failed"
+      failed=1
+   else
+      echo "$name: passed"
+   fi
+done
+exit $failed
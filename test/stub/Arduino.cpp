@@ -0,0 +1,14 @@
+/*
+ * Open Airbus Cockpit - Arduino host test stubs
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "Arduino.h"
+
+unsigned long fakeMicros = 0;
+int fakePins[128];
+int fakeAnalogValue = 0;
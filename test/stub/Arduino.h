@@ -0,0 +1,69 @@
+/*
+ * Open Airbus Cockpit - Arduino host test stubs
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OAC_TEST_ARDUINO_H
+#define OAC_TEST_ARDUINO_H
+
+/*
+ * A minimal replacement of the Arduino core to run the libraries on a host.
+ * Time only advances when the tests say so (see `fakeMicros`), and pins are
+ * plain variables (see `fakePins`). 
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define CHANGE 1
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const byte*)(addr))
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+class __FlashStringHelper;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+extern unsigned long fakeMicros;
+extern int fakePins[128];
+extern int fakeAnalogValue;
+
+inline unsigned long micros() { return fakeMicros; }
+inline unsigned long millis() { return fakeMicros / 1000; }
+inline void delay(unsigned long ms) { fakeMicros += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { fakeMicros += us; }
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t pin) { return fakePins[pin]; }
+inline void digitalWrite(uint8_t pin, uint8_t value) { fakePins[pin] = value; }
+inline int analogRead(uint8_t) { return fakeAnalogValue; }
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+   return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+#endif
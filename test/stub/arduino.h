@@ -0,0 +1,2 @@
+/* Some libraries include the core with its lowercase name. */
+#include "Arduino.h"
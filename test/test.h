@@ -0,0 +1,28 @@
+/*
+ * Open Airbus Cockpit - Arduino host tests
+ * Copyright (c) 2012-2015 Alvaro Polo
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OAC_TEST_H
+#define OAC_TEST_H
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+/** Report a failure if the condition is false, and go on. */
+#define CHECK(cond) do { \
+      if (!(cond)) { \
+         printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+         testFailures++; \
+      } \
+   } while (0)
+
+/** The exit status of the test program. */
+#define TEST_RESULT() (testFailures ? 1 : 0)
+
+#endif